@@ -0,0 +1,139 @@
+//
+// blur.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+// Compares the shadowBlur summed-area table blur prior to
+// src/blur.cc against each supported kernel, across radii,
+// on ARGB32 and on the A8 masks shadows are blurred as.
+//
+//   $ make benchmark-blur
+//
+
+#include "blur.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define WIDTH 750
+#define HEIGHT 750
+#define TIMES 5
+
+/*
+ * Previous Context2d::blur(), Steve Hanov, 2009.
+ * Released into the public domain.
+ */
+
+static void
+blurLegacy(uint8_t *src, int width, int height, int radius) {
+  --radius;
+  unsigned *precalc = (unsigned *) malloc(width * height * sizeof(unsigned));
+  double mul = 1.f / ((radius * 2) * (radius * 2));
+  for (int iteration = 0; iteration < 3; ++iteration) {
+    for (int channel = 0; channel < 4; ++channel) {
+      uint8_t *pix = src + channel;
+      unsigned *pre = precalc;
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          int tot = pix[0];
+          if (x > 0) tot += pre[-1];
+          if (y > 0) tot += pre[-width];
+          if (x > 0 && y > 0) tot -= pre[-width - 1];
+          *pre++ = tot;
+          pix += 4;
+        }
+      }
+      pix = src + radius * width * 4 + radius * 4 + channel;
+      for (int y = radius; y < height - radius; ++y) {
+        for (int x = radius; x < width - radius; ++x) {
+          int l = x - radius, t = y - radius
+            , r = x + radius >= width ? width - 1 : x + radius
+            , b = y + radius >= height ? height - 1 : y + radius
+            , tot = precalc[r + b * width] + precalc[l + t * width]
+              - precalc[l + b * width] - precalc[r + t * width];
+          *pix = (uint8_t) (tot * mul);
+          pix += 4;
+        }
+        pix += radius * 2 * 4;
+      }
+    }
+  }
+  free(precalc);
+}
+
+/*
+ * Milliseconds since the epoch.
+ */
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/*
+ * Fill `data` with a premultiplied pattern.
+ */
+
+static void
+fill(uint8_t *data) {
+  for (int i = 0; i < WIDTH * HEIGHT; ++i) {
+    uint8_t a = (i * 7) & 0xff;
+    data[i * 4 + 0] = a * (i & 0xff) / 255;
+    data[i * 4 + 1] = a * ((i >> 8) & 0xff) / 255;
+    data[i * 4 + 2] = a * ((i >> 16) & 0xff) / 255;
+    data[i * 4 + 3] = a;
+  }
+}
+
+int
+main() {
+  const char *kernels[] = { "sse2", "neon", "scalar" };
+  const int radii[] = { 2, 5, 10, 20, 50, 100, 200 };
+  const int nradii = sizeof(radii) / sizeof(radii[0]);
+  uint8_t *argb = (uint8_t *) malloc(WIDTH * HEIGHT * 4)
+    , *a8 = (uint8_t *) malloc(WIDTH * HEIGHT);
+  if (!argb || !a8) return 1;
+  canvas_blur_scratch_t scratch;
+  canvas_blur_scratch_init(&scratch);
+
+  printf("\n  %dx%d, %d times, ms per blur\n\n  %-16s", WIDTH, HEIGHT, TIMES, "");
+  for (int i = 0; i < nradii; ++i) printf("  r=%-5d", radii[i]);
+  printf("\n");
+
+  printf("  - \x1b[33m%-12s\x1b[0m", "legacy");
+  for (int i = 0; i < nradii; ++i) {
+    fill(argb);
+    double start = now();
+    for (int n = 0; n < TIMES; ++n) blurLegacy(argb, WIDTH, HEIGHT, radii[i]);
+    printf("  %7.2f", (now() - start) / TIMES);
+  }
+  printf("\n");
+
+  for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+    if (!canvas_blur_use(kernels[k])) continue;
+    for (int channels = 4; channels >= 1; channels -= 3) {
+      uint8_t *data = 4 == channels ? argb : a8;
+      char label[32];
+      snprintf(label, sizeof(label), "%s %s", kernels[k], 4 == channels ? "argb" : "a8");
+      printf("  - \x1b[33m%-12s\x1b[0m", label);
+      for (int i = 0; i < nradii; ++i) {
+        fill(argb);
+        if (1 == channels) for (int p = 0; p < WIDTH * HEIGHT; ++p) a8[p] = argb[p * 4 + 3];
+        double start = now();
+        for (int n = 0; n < TIMES; ++n)
+          canvas_blur(data, WIDTH, HEIGHT, WIDTH * channels, channels, radii[i], &scratch);
+        printf("  %7.2f", (now() - start) / TIMES);
+      }
+      printf("\n");
+    }
+  }
+  printf("\n");
+
+  canvas_blur_scratch_free(&scratch);
+  free(argb);
+  free(a8);
+  return 0;
+}
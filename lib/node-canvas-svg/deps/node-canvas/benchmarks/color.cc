@@ -0,0 +1,60 @@
+//
+// color.cc
+//
+// Times rgba_from_string() on the kinds of colour strings
+// canvg assigns per element.
+//
+//   $ make benchmark-color
+//
+
+#include "color.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+#define TIMES 1000000
+
+/*
+ * Current time in milliseconds.
+ */
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/*
+ * Parse each of `strs` TIMES times, printing ns per parse.
+ */
+
+static void
+bm(const char *label, const char **strs, int n) {
+  volatile int32_t sink = 0;
+  short ok;
+  double start = now();
+  for (int i = 0; i < TIMES; ++i) {
+    sink += rgba_from_string(strs[i % n], &ok);
+  }
+  printf("  - \x1b[33m%-12s\x1b[0m %7.1f ns\n", label, (now() - start) * 1e6 / TIMES);
+}
+
+int
+main() {
+  const char *hex[] = { "#ffccaa", "#fca", "#3366cc", "#ff000080" };
+  const char *rgb[] = { "rgb(51, 102, 204)", "rgba(255,0,0,0.5)", "rgb(100%, 50%, 0%)" };
+  const char *hsl[] = { "hsl(120, 100%, 25%)", "hsla(240, 50%, 50%, 0.25)" };
+  const char *early[] = { "aqua", "black", "blue" };
+  const char *late[] = { "white", "yellow", "yellowgreen", "whitesmoke" };
+  const char *unknown[] = { "none", "currentColor", "inherit" };
+
+  printf("\n  %d parses each\n\n", TIMES);
+  bm("hex", hex, 4);
+  bm("rgb", rgb, 3);
+  bm("hsl", hsl, 2);
+  bm("names a-b", early, 3);
+  bm("names w-y", late, 4);
+  bm("unknown", unknown, 3);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,126 @@
+//
+// pixels.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+// Compares the getImageData() / putImageData() pixel loops
+// prior to premultiply.cc against each supported kernel.
+//
+//   $ make benchmark-pixels
+//
+
+#include "premultiply.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define TIMES 20
+
+/*
+ * Previous getImageData() loop.
+ */
+
+static void
+unpremultiplyLegacy(const uint32_t *src, uint8_t *dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    int bx = x * 4;
+    const uint32_t *pixel = src + x;
+    uint8_t a = *pixel >> 24;
+    uint8_t r = *pixel >> 16;
+    uint8_t g = *pixel >> 8;
+    uint8_t b = *pixel;
+    dst[bx + 3] = a;
+    float alpha = (float) a / 255;
+    dst[bx + 0] = (int)((float) r / alpha);
+    dst[bx + 1] = (int)((float) g / alpha);
+    dst[bx + 2] = (int)((float) b / alpha);
+  }
+}
+
+/*
+ * Previous putImageData() loop.
+ */
+
+static void
+premultiplyLegacy(const uint8_t *src, uint32_t *dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    int bx = x * 4;
+    uint8_t a = src[bx + 3];
+    uint8_t r = src[bx + 0];
+    uint8_t g = src[bx + 1];
+    uint8_t b = src[bx + 2];
+    float alpha = (float) a / 255;
+    dst[x] = a << 24
+      | (int)((float) r * alpha) << 16
+      | (int)((float) g * alpha) << 8
+      | (int)((float) b * alpha);
+  }
+}
+
+/*
+ * Milliseconds since the epoch.
+ */
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/*
+ * Time TIMES passes of both directions over the image.
+ */
+
+static void
+bm(const char *label
+  , void (*unpremultiply)(const uint32_t *, uint8_t *, int)
+  , void (*premultiply)(const uint8_t *, uint32_t *, int)
+  , uint32_t *argb
+  , uint8_t *rgba) {
+  double start = now();
+  for (int i = 0; i < TIMES; ++i)
+    for (int y = 0; y < HEIGHT; ++y)
+      unpremultiply(argb + y * WIDTH, rgba + y * WIDTH * 4, WIDTH);
+  double mid = now();
+  for (int i = 0; i < TIMES; ++i)
+    for (int y = 0; y < HEIGHT; ++y)
+      premultiply(rgba + y * WIDTH * 4, argb + y * WIDTH, WIDTH);
+  double end = now();
+
+  printf("  - \x1b[33m%-8s\x1b[0m unpremultiply %7.2fms  premultiply %7.2fms\n"
+    , label
+    , (mid - start) / TIMES
+    , (end - mid) / TIMES);
+}
+
+int
+main() {
+  const char *kernels[] = { "avx2", "sse2", "neon", "scalar" };
+  uint32_t *argb = (uint32_t *) malloc(WIDTH * HEIGHT * 4);
+  uint8_t *rgba = (uint8_t *) malloc(WIDTH * HEIGHT * 4);
+  if (!argb || !rgba) return 1;
+
+  // Premultiplied gradient with a spread of alpha values
+  for (int i = 0; i < WIDTH * HEIGHT; ++i) {
+    uint32_t a = (i * 7) & 0xff;
+    argb[i] = a << 24
+      | (a * (i & 0xff) / 255) << 16
+      | (a * ((i >> 8) & 0xff) / 255) << 8
+      | (a * ((i >> 16) & 0xff) / 255);
+  }
+
+  printf("\n  %dx%d, %d times\n\n", WIDTH, HEIGHT, TIMES);
+  bm("legacy", unpremultiplyLegacy, premultiplyLegacy, argb, rgba);
+  for (unsigned i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+    if (canvas_premultiply_use(kernels[i]))
+      bm(kernels[i], canvas_unpremultiply, canvas_premultiply, argb, rgba);
+  }
+  printf("\n");
+
+  free(argb);
+  free(rgba);
+  return 0;
+}
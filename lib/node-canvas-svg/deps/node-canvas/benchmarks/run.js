@@ -6,6 +6,7 @@
 var Canvas = require('../lib/canvas')
   , canvas = new Canvas(200, 200)
   , largeCanvas = new Canvas(1000, 1000)
+  , shadowCanvas = new Canvas(750, 750)
   , ctx = canvas.getContext('2d');
 
 var times = 10000;
@@ -81,10 +82,22 @@ bm('toBuffer() 1000x1000', 50, function(){
   largeCanvas.toBuffer();
 });
 
+var out = new Buffer(4 * 1024 * 1024);
+
+bm('toBuffer(buffer) 1000x1000', 50, function(){
+  largeCanvas.toBuffer(out);
+});
+
 bm('toBuffer().toString("base64") 200x200', 50, function(){
   canvas.toBuffer().toString('base64');
 });
 
+bm('Canvas.renderBatch() 10 x 200x200', 5, function(done){
+  var canvases = [];
+  for (var i = 0; i < 10; ++i) canvases.push(canvas);
+  Canvas.renderBatch(canvases, function(){ done(); });
+});
+
 bm('toDataURL() 200x200', 50, function(){
   canvas.toDataURL();
 });
@@ -101,6 +114,15 @@ bm('moveTo() / arc() / stroke()', function(){
   ctx.stroke();
 });
 
+bm('shadowBlur=10 arc() / fill() 750x750', 500, function(){
+  var ctx = shadowCanvas.getContext('2d');
+  ctx.shadowColor = 'rgba(0,0,0,0.5)';
+  ctx.shadowBlur = 10;
+  ctx.beginPath();
+  ctx.arc(375,375,10,0,Math.PI*2,true);
+  ctx.fill();
+});
+
 bm('createImageData(300,300)', function(){
   ctx.createImageData(300,300);
 });
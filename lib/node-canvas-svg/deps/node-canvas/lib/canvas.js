@@ -16,6 +16,7 @@ var canvas = require('../build/Release/canvas')
   , PixelArray = canvas.PixelArray
   , Context2d = require('./context2d')
   , PNGStream = require('./pngstream')
+  , JPEGStream = require('./jpegstream')
   , fs = require('fs');
 
 /**
@@ -36,12 +37,24 @@ exports.version = '0.3.3';
 
 exports.cairoVersion = cairoVersion;
 
+/**
+ * PNG row filters, combine with `|` for the `filters` option.
+ */
+
+exports.PNG_FILTER_NONE = 0x01;
+exports.PNG_FILTER_SUB = 0x02;
+exports.PNG_FILTER_UP = 0x04;
+exports.PNG_FILTER_AVG = 0x08;
+exports.PNG_FILTER_PAETH = 0x10;
+exports.PNG_ALL_FILTERS = 0x1f;
+
 /**
  * Expose constructors.
  */
 
 exports.Context2d = Context2d;
 exports.PNGStream = PNGStream;
+exports.JPEGStream = JPEGStream;
 exports.PixelArray = PixelArray;
 exports.Image = Image;
 
@@ -94,53 +107,72 @@ Canvas.prototype.getContext = function(contextId){
 /**
  * Create a `PNGStream` for `this` canvas.
  *
+ * @param {Object} options
  * @return {PNGStream}
  * @api public
  */
 
-Canvas.prototype.createPNGStream = function(){
-  return new PNGStream(this);
+Canvas.prototype.createPNGStream = function(options){
+  return new PNGStream(this, false, options);
 };
 
 /**
  * Create a synchronous `PNGStream` for `this` canvas.
  *
+ * @param {Object} options
  * @return {PNGStream}
  * @api public
  */
 
-Canvas.prototype.createSyncPNGStream = function(){
-  return new PNGStream(this, true);
+Canvas.prototype.createSyncPNGStream = function(options){
+  return new PNGStream(this, true, options);
+};
+
+/**
+ * Create a `JPEGStream` for `this` canvas.
+ *
+ * @param {Object} options
+ * @return {JPEGStream}
+ * @api public
+ */
+
+Canvas.prototype.createJPEGStream = function(options){
+  return new JPEGStream(this, options);
 };
 
 /**
  * Return a data url. Pass a function for async support.
+ * Supports "image/png" and "image/jpeg", JPEG encoder
+ * options may be passed after the type.
  *
  * @param {String|Function} type
+ * @param {Object|Function} options
  * @param {Function} fn
  * @return {String}
  * @api public
  */
 
-Canvas.prototype.toDataURL = function(type, fn){
+Canvas.prototype.toDataURL = function(type, options, fn){
   // Default to png
   type = type || 'image/png';
 
-  // Allow callback as first arg
+  // Allow callback as first or second arg
   if ('function' == typeof type) fn = type, type = 'image/png';
+  if ('function' == typeof options) fn = options, options = null;
 
-  // Throw on non-png
-  if ('image/png' != type) throw new Error('currently only image/png is supported');
+  // Throw on unsupported types
+  if ('image/png' != type && 'image/jpeg' != type) {
+    throw new Error('currently only image/png and image/jpeg are supported');
+  }
 
   var prefix = 'data:' + type + ';base64,';
 
   if (fn) {
-    this.toBuffer(function(err, buf){
+    this.toBuffer(type, options || {}, function(err, buf){
       if (err) return fn(err);
-      var str = 'data:' + type
       fn(null, prefix + buf.toString('base64'));
     });
   } else {
-    return prefix + this.toBuffer().toString('base64');
+    return prefix + this.toBuffer(type, options || {}).toString('base64');
   }
 };
@@ -146,7 +146,7 @@ Context2d.prototype.__defineSetter__('fillStyle', function(val){
  */
 
 Context2d.prototype.__defineGetter__('fillStyle', function(){
-  return this.lastFillStyle || this.fillColor;
+  return this.fillColor || this.lastFillStyle;
 });
 
 /**
@@ -172,7 +172,7 @@ Context2d.prototype.__defineSetter__('strokeStyle', function(val){
  */
 
 Context2d.prototype.__defineGetter__('strokeStyle', function(){
-  return this.lastStrokeStyle || this.strokeColor;
+  return this.strokeColor || this.lastStrokeStyle;
 });
 
 
@@ -0,0 +1,59 @@
+
+/*!
+ * Canvas - JPEGStream
+ * Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+ * MIT Licensed
+ */
+
+/**
+ * Module dependencies.
+ */
+
+var EventEmitter = require('events').EventEmitter;
+
+/**
+ * Initialize a `JPEGStream` with the given `canvas`.
+ *
+ * "data" events are emitted with `Buffer` chunks, once complete the
+ * "end" event is emitted. Encoding is performed on the thread pool.
+ *
+ *     var out = fs.createWriteStream(__dirname + '/my.jpg')
+ *       , stream = canvas.createJPEGStream({ quality: 90 });
+ *
+ *     stream.on('data', function(chunk){
+ *       out.write(chunk);
+ *     });
+ *
+ *     stream.on('end', function(){
+ *       out.end();
+ *     });
+ *
+ * Encoder options `quality` and `progressive` may be passed,
+ * see `Canvas#toBuffer()`.
+ *
+ * @param {Canvas} canvas
+ * @param {Object} options
+ * @api public
+ */
+
+var JPEGStream = module.exports = function JPEGStream(canvas, options) {
+  var self = this;
+  this.canvas = canvas;
+  process.nextTick(function(){
+    canvas.streamJPEG(function(err, chunk, len){
+      if (err) {
+        self.emit('error', err);
+      } else if (len) {
+        self.emit('data', chunk, len);
+      } else {
+        self.emit('end');
+      }
+    }, options);
+  });
+};
+
+/**
+ * Inherit from `EventEmitter`.
+ */
+
+JPEGStream.prototype.__proto__ = EventEmitter.prototype;
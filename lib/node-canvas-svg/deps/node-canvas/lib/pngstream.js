@@ -29,20 +29,22 @@ var EventEmitter = require('events').EventEmitter;
  *       out.end();
  *     });
  *
+ * Encoder options such as `compressionLevel`, `filters` and `backend`
+ * may be passed, see `Canvas#toBuffer()`.
+ *
  * @param {Canvas} canvas
  * @param {Boolean} sync
+ * @param {Object} options
  * @api public
  */
 
-var PNGStream = module.exports = function PNGStream(canvas, sync) {
+var PNGStream = module.exports = function PNGStream(canvas, sync, options) {
   var self = this
     , method = sync
       ? 'streamPNGSync'
       : 'streamPNG';
   this.sync = sync;
   this.canvas = canvas;
-  // TODO: implement async
-  if ('streamPNG' == method) method = 'streamPNGSync';
   process.nextTick(function(){
     canvas[method](function(err, chunk, len){
       if (err) {
@@ -52,7 +54,7 @@ var PNGStream = module.exports = function PNGStream(canvas, sync) {
       } else {
         self.emit('end');
       }
-    });
+    }, options);
   });
 };
 
@@ -8,9 +8,15 @@
 #include "Canvas.h"
 #include "CanvasRenderingContext2d.h"
 #include "closure.h"
+#include "hash.h"
+#include "surfacepool.h"
+#include "memstats.h"
+#include "format.h"
+#include "tiles.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <node_buffer.h>
 #include <node_version.h>
 
@@ -42,23 +48,129 @@ Canvas::Initialize(Handle<Object> target) {
   // Prototype
   Local<ObjectTemplate> proto = constructor->PrototypeTemplate();
   NODE_SET_PROTOTYPE_METHOD(constructor, "toBuffer", ToBuffer);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "streamPNG", StreamPNG);
   NODE_SET_PROTOTYPE_METHOD(constructor, "streamPNGSync", StreamPNGSync);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "streamJPEG", StreamJPEG);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "contentHash", ContentHash);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "getDirtyRect", GetDirtyRect);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "resetDirty", ResetDirty);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "markDirty", MarkDirty);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "getRawBuffer", GetRawBuffer);
   proto->SetAccessor(String::NewSymbol("width"), GetWidth, SetWidth);
   proto->SetAccessor(String::NewSymbol("height"), GetHeight, SetHeight);
+  proto->SetAccessor(String::NewSymbol("generation"), GetGeneration);
+  proto->SetAccessor(String::NewSymbol("type"), GetType);
+  proto->SetAccessor(String::NewSymbol("format"), GetFormat);
+  proto->SetAccessor(String::NewSymbol("stride"), GetStride);
+  NODE_SET_METHOD(constructor, "poolStats", PoolStats);
+  NODE_SET_METHOD(constructor, "configurePool", ConfigurePool);
+  NODE_SET_METHOD(constructor, "memoryStats", MemoryStats);
+  NODE_SET_METHOD(constructor, "renderBatch", RenderBatch);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "memoryStats", MemoryStats);
   target->Set(String::NewSymbol("Canvas"), constructor->GetFunction());
 }
 
 /*
- * Initialize a Canvas with the given width and height.
+ * Parse the "format" of `obj` into `format`, returning 0
+ * when unsupported.
+ */
+
+static int
+parseFormat(Handle<Object> obj, cairo_format_t *format) {
+  HandleScope scope;
+  Local<Value> val = obj->Get(String::NewSymbol("format"));
+  if (!val->IsString()) return 1;
+  String::AsciiValue str(val);
+  return canvas_format_parse(*str, format);
+}
+
+/*
+ * Initialize a Canvas with the given width, height and
+ * optional type, "image" (the default) or "recording", or
+ * options object:
+ *
+ *  - type    "image" or "recording"
+ *  - format  "argb32" (the default), "rgb24", "a8" or "rgb16_565"
+ *
+ * When a Buffer is passed first the canvas draws straight into
+ * its memory, see NewForData().
  */
 
 Handle<Value>
 Canvas::New(const Arguments &args) {
   HandleScope scope;
+  if (Buffer::HasInstance(args[0])) return NewForData(args);
+
   int width = 0, height = 0;
+  canvas_type_t type = CANVAS_TYPE_IMAGE;
+  cairo_format_t format = CAIRO_FORMAT_ARGB32;
   if (args[0]->IsNumber()) width = args[0]->Uint32Value();
   if (args[1]->IsNumber()) height = args[1]->Uint32Value();
-  Canvas *canvas = new Canvas(width, height);
+
+  Local<Value> typeVal = args[2];
+  if (args[2]->IsObject()) {
+    Local<Object> obj = args[2]->ToObject();
+    typeVal = obj->Get(String::NewSymbol("type"));
+    if (!parseFormat(obj, &format))
+      return ThrowException(Exception::TypeError(String::New("unsupported canvas format")));
+  }
+
+  if (typeVal->IsString()) {
+    String::AsciiValue str(typeVal);
+    if (0 == strcmp("recording", *str)) {
+#if CAIRO_VERSION_MINOR < 10
+      return ThrowException(Exception::Error(String::New("recording canvases need cairo >= 1.10.0")));
+#endif
+      type = CANVAS_TYPE_RECORDING;
+    } else if (strcmp("image", *str)) {
+      return ThrowException(Exception::TypeError(String::New("unsupported canvas type")));
+    }
+  }
+
+  Canvas *canvas = new Canvas(width, height, type, format);
+  canvas->Wrap(args.This());
+  return args.This();
+}
+
+/*
+ * Initialize a Canvas over the memory of a Buffer, which
+ * is kept alive for as long as the canvas draws into it.
+ * Options:
+ *
+ *  - stride  bytes per row, defaults to the minimum for the format
+ *  - format  as for New(), defaults to "argb32"
+ *
+ *  - buffer, width, height, [options]
+ *
+ */
+
+Handle<Value>
+Canvas::NewForData(const Arguments &args) {
+  HandleScope scope;
+  Local<Object> buffer = args[0]->ToObject();
+  int width = 0, height = 0, stride = -1;
+  cairo_format_t format = CAIRO_FORMAT_ARGB32;
+  if (args[1]->IsNumber()) width = args[1]->Uint32Value();
+  if (args[2]->IsNumber()) height = args[2]->Uint32Value();
+
+  if (args[3]->IsObject()) {
+    Local<Object> obj = args[3]->ToObject();
+    if (!parseFormat(obj, &format))
+      return ThrowException(Exception::TypeError(String::New("unsupported canvas format")));
+    Local<Value> strideVal = obj->Get(String::NewSymbol("stride"));
+    if (strideVal->IsNumber()) stride = strideVal->Int32Value();
+  }
+
+  int min = cairo_format_stride_for_width(format, width);
+  if (stride < 0) stride = min;
+  if (stride < min || stride % 4)
+    return ThrowException(Exception::TypeError(String::New("invalid stride")));
+  if ((size_t) stride * height > Buffer::Length(buffer))
+    return ThrowException(Exception::Error(String::New("buffer too small")));
+  if ((uintptr_t) Buffer::Data(buffer) % 4)
+    return ThrowException(Exception::Error(String::New("buffer must be 4 byte aligned")));
+
+  Canvas *canvas = new Canvas(buffer, width, height, stride, format);
   canvas->Wrap(args.This());
   return args.This();
 }
@@ -110,24 +222,456 @@ Canvas::SetHeight(Local<String> prop, Local<Value> val, const AccessorInfo &info
 }
 
 /*
- * Canvas::ToBuffer callback.
+ * Get generation, bumped whenever the surface is drawn to.
  */
 
-static cairo_status_t
-toBuffer(void *c, const uint8_t *data, unsigned len) {
-  closure_t *closure = (closure_t *) c;
-  if (closure->len) {
-    closure->data = (uint8_t *) realloc(closure->data, closure->len + len);
-    if (!closure->data) return CAIRO_STATUS_NO_MEMORY;
-    memcpy(closure->data + closure->len, data, len);
-    closure->len += len;
+Handle<Value>
+Canvas::GetGeneration(Local<String> prop, const AccessorInfo &info) {
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(info.This());
+  return Number::New(canvas->generation);
+}
+
+/*
+ * Get type, "image" or "recording".
+ */
+
+Handle<Value>
+Canvas::GetType(Local<String> prop, const AccessorInfo &info) {
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(info.This());
+  return String::New(canvas->isRecording() ? "recording" : "image");
+}
+
+/*
+ * Get surface format name.
+ */
+
+Handle<Value>
+Canvas::GetFormat(Local<String> prop, const AccessorInfo &info) {
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(info.This());
+  return String::New(canvas_format_name(canvas->format));
+}
+
+/*
+ * Get surface stride in bytes, 0 for recordings.
+ */
+
+Handle<Value>
+Canvas::GetStride(Local<String> prop, const AccessorInfo &info) {
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(info.This());
+  return Number::New(canvas->isRecording() ? 0 : canvas->stride());
+}
+
+/*
+ * Count of raw buffers viewing a surface, kept as its
+ * user data. Surfaces are also referenced by contexts,
+ * so the reference count cannot tell.
+ */
+
+static cairo_user_data_key_t rawCountKey;
+
+static int
+rawCount(cairo_surface_t *surface) {
+  int *count = (int *) cairo_surface_get_user_data(surface, &rawCountKey);
+  return count ? *count : 0;
+}
+
+/*
+ * Free callback for raw buffers, dropping the surface
+ * reference and count taken in GetRawBuffer().
+ */
+
+#if NODE_VERSION_AT_LEAST(0,3,0)
+static void
+releaseRaw(char *data, void *hint) {
+  cairo_surface_t *surface = (cairo_surface_t *) hint;
+  int *count = (int *) cairo_surface_get_user_data(surface, &rawCountKey);
+  if (count) --*count;
+  cairo_surface_destroy(surface);
+}
+#endif
+
+/*
+ * Return a Buffer over the surface memory, `stride * height`
+ * bytes in the canvas format without conversion, ARGB32 being
+ * premultiplied BGRA on little-endian hosts. No copy is made,
+ * the Buffer holds a reference to the surface so its memory
+ * outlives a resize or the canvas itself, after which it no
+ * longer reflects the canvas. Writes must be followed by
+ * markDirty() to be seen by getDirtyRect(). Once handed out
+ * the surface is rehashed on every contentHash().
+ */
+
+Handle<Value>
+Canvas::GetRawBuffer(const Arguments &args) {
+  HandleScope scope;
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
+  cairo_surface_t *surface = canvas->surface();
+  cairo_surface_flush(surface);
+  size_t len = (size_t) canvas->stride() * canvas->height;
+  canvas->_rawExposed = true;
+
+  // External memory, slice the Buffer it came from
+  if (!canvas->_buffer.IsEmpty()) {
+    Local<Function> slice = Local<Function>::Cast(canvas->_buffer->Get(String::NewSymbol("slice")));
+    Local<Value> argv[2] = { Integer::New(0), Number::New(len) };
+    return scope.Close(slice->Call(canvas->_buffer, 2, argv));
+  }
+
+#if NODE_VERSION_AT_LEAST(0,3,0)
+  int *count = (int *) cairo_surface_get_user_data(surface, &rawCountKey);
+  if (!count) {
+    count = (int *) calloc(1, sizeof(int));
+    if (!count || cairo_surface_set_user_data(surface, &rawCountKey, count, free)) {
+      free(count);
+      return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
+    }
+  }
+  ++*count;
+  Buffer *buf = Buffer::New(
+      (char *) canvas->data()
+    , len
+    , releaseRaw
+    , cairo_surface_reference(surface));
+#else
+  Buffer *buf = Buffer::New(len);
+  memcpy(BUFFER_DATA(buf), canvas->data(), len);
+#endif
+  return scope.Close(buf->handle_);
+}
+
+/*
+ * Return the surface content hash as 16 hex digits,
+ * suitable as an HTTP ETag.
+ */
+
+Handle<Value>
+Canvas::ContentHash(const Arguments &args) {
+  HandleScope scope;
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+  uint64_t hash = canvas->contentHash();
+  char hex[17];
+  for (int i = 15; i >= 0; --i, hash >>= 4)
+    hex[i] = "0123456789abcdef"[hash & 0xf];
+  hex[16] = 0;
+  return scope.Close(String::New(hex));
+}
+
+/*
+ * Return the device-space rectangle drawn to since
+ * the last resetDirty() as { x, y, width, height },
+ * or null when nothing has been drawn.
+ */
+
+Handle<Value>
+Canvas::GetDirtyRect(const Arguments &args) {
+  HandleScope scope;
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  if (!canvas->isDirty()) return Null();
+  Local<Object> rect = Object::New();
+  rect->Set(String::NewSymbol("x"), Number::New(canvas->_dirtyX1));
+  rect->Set(String::NewSymbol("y"), Number::New(canvas->_dirtyY1));
+  rect->Set(String::NewSymbol("width"), Number::New(canvas->_dirtyX2 - canvas->_dirtyX1));
+  rect->Set(String::NewSymbol("height"), Number::New(canvas->_dirtyY2 - canvas->_dirtyY1));
+  return scope.Close(rect);
+}
+
+/*
+ * Tell the canvas its memory was written to outside of
+ * cairo, through getRawBuffer() or the Buffer it was
+ * created over, adding the rectangle to the dirty
+ * rectangle and bumping the generation.
+ *
+ *  - [x, y, width, height]
+ *
+ */
+
+Handle<Value>
+Canvas::MarkDirty(const Arguments &args) {
+  HandleScope scope;
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
+  double x = 0, y = 0, w = canvas->width, h = canvas->height;
+  if (args.Length() >= 4) {
+    x = args[0]->NumberValue();
+    y = args[1]->NumberValue();
+    w = args[2]->NumberValue();
+    h = args[3]->NumberValue();
+  }
+
+  cairo_surface_mark_dirty(canvas->surface());
+  canvas->markDirty(x, y, x + w, y + h);
+  return Undefined();
+}
+
+/*
+ * Reset the dirty rectangle.
+ */
+
+Handle<Value>
+Canvas::ResetDirty(const Arguments &args) {
+  HandleScope scope;
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  canvas->resetDirty();
+  return Undefined();
+}
+
+/*
+ * Return the surface pool counters and limits.
+ */
+
+Handle<Value>
+Canvas::PoolStats(const Arguments &args) {
+  HandleScope scope;
+  surface_pool_stats_t stats;
+  surface_pool_stats(&stats);
+  Local<Object> obj = Object::New();
+  obj->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+  obj->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+  obj->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+  obj->Set(String::NewSymbol("blocks"), Number::New(stats.blocks));
+  obj->Set(String::NewSymbol("maxBytes"), Number::New(stats.maxBytes));
+  obj->Set(String::NewSymbol("maxPerClass"), Number::New(stats.maxPerClass));
+  return scope.Close(obj);
+}
+
+/*
+ * Set the surface pool retention limits:
+ *
+ *  - maxBytes     bytes retained across all sizes, 0 disables pooling
+ *  - maxPerClass  surfaces retained per size class
+ *
+ */
+
+Handle<Value>
+Canvas::ConfigurePool(const Arguments &args) {
+  HandleScope scope;
+  if (!args[0]->IsObject())
+    return ThrowException(Exception::TypeError(String::New("options object required")));
+
+  surface_pool_stats_t stats;
+  surface_pool_stats(&stats);
+
+  Local<Object> obj = args[0]->ToObject();
+  Local<Value> maxBytes = obj->Get(String::NewSymbol("maxBytes"));
+  Local<Value> maxPerClass = obj->Get(String::NewSymbol("maxPerClass"));
+  if (maxBytes->IsNumber()) stats.maxBytes = (unsigned long) fmax(0, maxBytes->NumberValue());
+  if (maxPerClass->IsNumber()) stats.maxPerClass = (unsigned) fmax(0, maxPerClass->NumberValue());
+
+  surface_pool_configure(stats.maxBytes, stats.maxPerClass);
+  return Undefined();
+}
+
+/*
+ * Return live object counts and native bytes per type,
+ * see memstats_to_object().
+ */
+
+Handle<Value>
+Canvas::MemoryStats(const Arguments &args) {
+  HandleScope scope;
+  return scope.Close(memstats_to_object());
+}
+
+/*
+ * Populate PNG encoder options from the given object:
+ *
+ *  - compressionLevel  0-9, or 0-12 with libdeflate
+ *  - filters           bitmask of Canvas.PNG_FILTER_*
+ *  - backend           "cairo", "zlib" or "libdeflate"
+ *  - palette           write 8-bit indexed color
+ *  - dither            dither when the palette is quantized
+ *  - strips            deflate this many strips in parallel (zlib only)
+ *
+ * Specifying a level, filters, palette or strips without a
+ * backend selects zlib. Palette output defaults to no row filtering.
+ * Returns an error message, or NULL.
+ */
+
+static const char *
+parsePNGOptions(Handle<Value> val, canvas_png_options_t *opts) {
+  HandleScope scope;
+  canvas_png_options_init(opts);
+  if (!val->IsObject()) return NULL;
+
+  Local<Object> obj = val->ToObject();
+  Local<Value> level = obj->Get(String::NewSymbol("compressionLevel"));
+  Local<Value> filters = obj->Get(String::NewSymbol("filters"));
+  Local<Value> backend = obj->Get(String::NewSymbol("backend"));
+  Local<Value> palette = obj->Get(String::NewSymbol("palette"));
+  Local<Value> strips = obj->Get(String::NewSymbol("strips"));
+
+  opts->palette = palette->BooleanValue();
+  opts->dither = obj->Get(String::NewSymbol("dither"))->BooleanValue();
+
+  if (level->IsNumber() || filters->IsNumber() || strips->IsNumber() || opts->palette)
+    opts->backend = CANVAS_PNG_BACKEND_ZLIB;
+  if (strips->IsNumber()) {
+    int n = strips->Int32Value();
+    opts->strips = n < 1 ? 1 : n > CANVAS_PNG_MAX_STRIPS ? CANVAS_PNG_MAX_STRIPS : n;
+  }
+  if (level->IsNumber())
+    opts->compressionLevel = level->Int32Value();
+  if (filters->IsNumber()) {
+    opts->filters = filters->Int32Value() & CANVAS_PNG_ALL_FILTERS;
+  } else if (opts->palette) {
+    opts->filters = CANVAS_PNG_FILTER_NONE;
+  }
+
+  if (backend->IsString()) {
+    String::AsciiValue str(backend);
+    if (0 == strcmp("zlib", *str)) {
+      opts->backend = CANVAS_PNG_BACKEND_ZLIB;
+    } else if (0 == strcmp("libdeflate", *str)) {
+#ifdef HAVE_LIBDEFLATE
+      opts->backend = CANVAS_PNG_BACKEND_LIBDEFLATE;
+#else
+      return "libdeflate backend not available";
+#endif
+    } else if (0 == strcmp("cairo", *str)) {
+      if (opts->palette) return "palette requires the zlib or libdeflate backend";
+      opts->backend = CANVAS_PNG_BACKEND_CAIRO;
+    } else {
+      return "invalid backend";
+    }
+  }
+
+  int max = CANVAS_PNG_BACKEND_LIBDEFLATE == opts->backend ? 12 : 9;
+  if (opts->compressionLevel < 0) opts->compressionLevel = 0;
+  if (opts->compressionLevel > max) opts->compressionLevel = max;
+  return NULL;
+}
+
+/*
+ * Populate JPEG encoder options from the given object:
+ *
+ *  - quality      0-100, defaults to 75
+ *  - progressive  boolean, defaults to false
+ *
+ */
+
+static const char *
+parseJPEGOptions(Handle<Value> val, canvas_jpeg_options_t *opts) {
+  HandleScope scope;
+  canvas_jpeg_options_init(opts);
+  if (!val->IsObject()) return NULL;
+
+  Local<Object> obj = val->ToObject();
+  Local<Value> quality = obj->Get(String::NewSymbol("quality"));
+  Local<Value> progressive = obj->Get(String::NewSymbol("progressive"));
+
+  if (quality->IsNumber()) {
+    int n = quality->Int32Value();
+    opts->quality = n < 0 ? 0 : n > 100 ? 100 : n;
+  }
+  opts->progressive = progressive->BooleanValue();
+  return NULL;
+}
+
+/*
+ * Populate raw encoder options from the given object:
+ *
+ *  - format  "rgba" (the default), "bgra" or "argb"
+ *
+ */
+
+static const char *
+parseRawOptions(Handle<Value> val, canvas_raw_options_t *opts) {
+  HandleScope scope;
+  canvas_raw_options_init(opts);
+  if (!val->IsObject()) return NULL;
+
+  Local<Value> format = val->ToObject()->Get(String::NewSymbol("format"));
+  if (format->IsString()) {
+    String::AsciiValue str(format);
+    if (!canvas_raw_layout_parse(*str, &opts->layout))
+      return "invalid raw format";
+  }
+  return NULL;
+}
+
+/*
+ * Populate encoder options for `type` from the given object.
+ */
+
+static const char *
+parseEncodeOptions(encode_type_t type, Handle<Value> val, encode_options_t *opts) {
+  encode_options_init(opts, type);
+  switch (type) {
+    case ENCODE_JPEG:
+      return parseJPEGOptions(val, &opts->jpeg);
+    case ENCODE_RAW:
+      return parseRawOptions(val, &opts->raw);
+    default:
+      return parsePNGOptions(val, &opts->png);
+  }
+}
+
+/*
+ * Parse the mime type `val` into `type`.
+ */
+
+static const char *
+parseEncodeType(Handle<Value> val, encode_type_t *type) {
+  String::AsciiValue str(val);
+  if (0 == strcmp("image/png", *str)) {
+    *type = ENCODE_PNG;
+  } else if (0 == strcmp("image/jpeg", *str)) {
+#ifdef HAVE_JPEG
+    *type = ENCODE_JPEG;
+#else
+    return "JPEG support not available";
+#endif
+  } else if (0 == strcmp("raw", *str)) {
+    *type = ENCODE_RAW;
   } else {
-    closure->data = (uint8_t *) malloc(len);
-    if (!closure->data) return CAIRO_STATUS_NO_MEMORY;
-    memcpy(closure->data, data, len);
-    closure->len += len;
+    return "unsupported image type";
   }
-  return CAIRO_STATUS_SUCCESS;
+  return NULL;
+}
+
+/*
+ * Free callback for buffers backed by encoder output.
+ */
+
+static void
+freeOutput(char *data, void *hint) {
+  free(data);
+}
+
+/*
+ * Wrap the encoded bytes in a node::Buffer. Owned output becomes
+ * the Buffer's backing store, caller-supplied output is sliced.
+ */
+
+static Handle<Value>
+outputToBuffer(output_buffer_t *out, Handle<Object> dst) {
+  HandleScope scope;
+
+  // Caller-supplied buffer
+  if (!out->owned) {
+    Local<Function> slice = Local<Function>::Cast(dst->Get(String::NewSymbol("slice")));
+    Local<Value> argv[2] = { Integer::New(0), Number::New(out->len) };
+    return scope.Close(slice->Call(dst, 2, argv));
+  }
+
+#if NODE_VERSION_AT_LEAST(0,3,0)
+  size_t len = out->len;
+  Buffer *buf = Buffer::New((char *) output_buffer_release(out), len, freeOutput, NULL);
+#else
+  Buffer *buf = Buffer::New(out->len);
+  memcpy(BUFFER_DATA(buf), out->data, out->len);
+  output_buffer_free(out);
+#endif
+  return scope.Close(buf->handle_);
 }
 
 /*
@@ -138,10 +682,12 @@ int
 Canvas::EIO_ToBuffer(eio_req *req) {
   closure_t *closure = (closure_t *) req->data;
 
-  closure->status = cairo_surface_write_to_png_stream(
+  if (!closure->hashed) closure->key.hash = closure->canvas->hashSurface();
+  closure->status = canvas_encode(
       closure->canvas->surface()
-    , toBuffer
-    , closure);
+    , &closure->encode
+    , output_buffer_write
+    , &closure->output);
 
   return 0;
 }
@@ -157,62 +703,364 @@ Canvas::EIO_AfterToBuffer(eio_req *req) {
   ev_unref(EV_DEFAULT_UC);
 
   if (closure->status) {
+    output_buffer_free(&closure->output);
     Local<Value> argv[1] = { Canvas::Error(closure->status) };
     closure->pfn->Call(Context::GetCurrent()->Global(), 1, argv);
   } else {
-    Buffer *buf = Buffer::New(closure->len);
-    memcpy(BUFFER_DATA(buf), closure->data, closure->len);
-    Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(buf->handle_) };
+    closure->canvas->encodeHint[closure->encode.type] = closure->output.len;
+    if (closure->generation == closure->canvas->generation) {
+      if (!closure->hashed) closure->canvas->setHash(closure->key.hash, closure->generation);
+      encode_cache_put(&closure->key, closure->output.data, closure->output.len);
+    }
+    Local<Value> argv[2] = {
+        Local<Value>::New(Null())
+      , Local<Value>::New(outputToBuffer(&closure->output, closure->pbuf)) };
     closure->pfn->Call(Context::GetCurrent()->Global(), 2, argv);
   }
 
-  closure->canvas->Unref();
+  Canvas *canvas = closure->canvas;
   closure->pfn.Dispose();
-  free(closure->data);
-  free(closure);
+  if (!closure->pbuf.IsEmpty()) closure->pbuf.Dispose();
+  canvas_arena_drop(&canvas->scratch);
+  canvas->Unref();
   return 0;
 }
 
 /*
- * Convert PNG data to a node::Buffer, async when a 
- * callback function is passed.
+ * Convert PNG, JPEG or raw pixel data to a node::Buffer, async
+ * when a callback function is passed. An optional Buffer may
+ * be passed to encode into, in which case a slice of it
+ * is returned. See parsePNGOptions(), parseJPEGOptions() and
+ * parseRawOptions() for options.
+ *
+ * Output is cached by surface content hash and options, so
+ * repeat calls on unchanged or identical surfaces skip encoding.
+ * Async calls hash on the thread pool along with the encode,
+ * so only hit when the hash is already known. The canvas
+ * scratch arena is reset once the encode completes.
+ *
+ *  - [type], [buffer], [options], [callback]
+ *
  */
 
 Handle<Value>
 Canvas::ToBuffer(const Arguments &args) {
   HandleScope scope;
   Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  cairo_status_t status;
+  const char *err = NULL;
+  int fn = 0;
+
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
+  // Mime type
+  encode_type_t type = ENCODE_PNG;
+  if (args[fn]->IsString()) {
+    if ((err = parseEncodeType(args[fn++], &type)))
+      return ThrowException(Exception::TypeError(String::New(err)));
+  }
+
+  // Preallocated buffer
+  Local<Object> dst;
+  if (Buffer::HasInstance(args[fn])) {
+    dst = args[fn++]->ToObject();
+  }
+
+  // Options
+  encode_options_t encode;
+  if (args[fn]->IsObject() && !args[fn]->IsFunction()) {
+    err = parseEncodeOptions(type, args[fn++], &encode);
+  } else {
+    encode_options_init(&encode, type);
+  }
+  if (err) return ThrowException(Exception::TypeError(String::New(err)));
+
+  // Cached output, async calls do not hash on the loop
+  bool async = args[fn]->IsFunction();
+  encode_cache_key_t key;
+  key.hash = 0;
+  key.width = canvas->width;
+  key.height = canvas->height;
+  key.opts = encode;
+  int hashed = 1;
+  if (!async) {
+    key.hash = canvas->contentHash();
+  } else if (!(hashed = canvas->knownHash(&key.hash))) {
+    cairo_surface_flush(canvas->surface());
+  }
+  const uint8_t *cached;
+  unsigned cachedLen;
+  int hit = hashed && encode_cache_get(&key, &cached, &cachedLen);
 
   // Async
-  if (args[0]->IsFunction()) {
-    closure_t *closure = (closure_t *) malloc(sizeof(closure_t));
-    closure->len = 0;
+  if (async) {
+    closure_t *closure = (closure_t *) canvas_arena_alloc(&canvas->scratch, sizeof(closure_t));
+    if (!closure) return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
+    canvas_arena_hold(&canvas->scratch);
+    if (dst.IsEmpty()) {
+      if ((status = output_buffer_init(&closure->output, hit ? cachedLen : canvas->encodeHint[type]))) {
+        canvas_arena_drop(&canvas->scratch);
+        return ThrowException(Canvas::Error(status));
+      }
+      closure->pbuf.Clear();
+    } else {
+      output_buffer_init_for_data(&closure->output
+        , (uint8_t *) Buffer::Data(dst)
+        , Buffer::Length(dst));
+      closure->pbuf = Persistent<Object>::New(dst);
+    }
+    closure->encode = encode;
+    closure->key = key;
+    closure->hashed = hashed;
+    closure->generation = canvas->generation;
     closure->canvas = canvas;
     // TODO: only one callback fn in closure
     canvas->Ref();
-    closure->pfn = Persistent<Function>::New(Handle<Function>::Cast(args[0]));
-    eio_custom(EIO_ToBuffer, EIO_PRI_DEFAULT, EIO_AfterToBuffer, closure);
+    closure->pfn = Persistent<Function>::New(Handle<Function>::Cast(args[fn]));
+    if (hit) {
+      closure->status = output_buffer_write(&closure->output, cached, cachedLen);
+      eio_nop(EIO_PRI_DEFAULT, EIO_AfterToBuffer, closure);
+    } else {
+      eio_custom(EIO_ToBuffer, EIO_PRI_DEFAULT, EIO_AfterToBuffer, closure);
+    }
     ev_ref(EV_DEFAULT_UC);
     return Undefined();
   } else {
-    closure_t closure;
-    closure.len = 0;
+    output_buffer_t output;
+    if (dst.IsEmpty()) {
+      if ((status = output_buffer_init(&output, hit ? cachedLen : canvas->encodeHint[type])))
+        return ThrowException(Canvas::Error(status));
+    } else {
+      output_buffer_init_for_data(&output
+        , (uint8_t *) Buffer::Data(dst)
+        , Buffer::Length(dst));
+    }
 
     TryCatch try_catch;
-    cairo_status_t status = cairo_surface_write_to_png_stream(canvas->surface(), toBuffer, &closure);
+    if (hit) {
+      status = output_buffer_write(&output, cached, cachedLen);
+    } else {
+      status = canvas_encode(canvas->surface(), &encode, output_buffer_write, &output);
+    }
+    canvas_arena_reset(&canvas->scratch);
 
     if (try_catch.HasCaught()) {
+      output_buffer_free(&output);
       return try_catch.ReThrow();
     } else if (status) {
+      output_buffer_free(&output);
       return ThrowException(Canvas::Error(status));
     } else {
-      Buffer *buf = Buffer::New(closure.len);
-      memcpy(BUFFER_DATA(buf), closure.data, closure.len);
-      return buf->handle_;
+      canvas->encodeHint[type] = output.len;
+      if (!hit) encode_cache_put(&key, output.data, output.len);
+      return scope.Close(outputToBuffer(&output, dst));
     }
   }
 }
 
+/*
+ * EIO renderBatch callback. Recordings are first replayed
+ * onto a scratch image surface from the job's own copy, as
+ * no two threads may replay the same recording.
+ */
+
+int
+Canvas::EIO_RenderBatch(eio_req *req) {
+  batch_job_t *job = (batch_job_t *) req->data;
+  Canvas *canvas = job->canvas;
+  cairo_surface_t *surface = canvas->surface();
+
+  if (!job->hashed && !canvas->isRecording()) job->key.hash = canvas->hashSurface();
+  if (job->recording) {
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, canvas->width, canvas->height);
+    cairo_t *cr = cairo_create(surface);
+    cairo_set_source_surface(cr, job->recording, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(job->recording);
+    job->recording = NULL;
+  }
+
+  job->status = cairo_surface_status(surface);
+  if (!job->status) {
+    job->status = canvas_encode(
+        surface
+      , &job->encode
+      , output_buffer_write
+      , &job->output);
+  }
+
+  if (surface != canvas->surface()) cairo_surface_destroy(surface);
+  return 0;
+}
+
+/*
+ * EIO after renderBatch callback. Invokes the callback
+ * once the last job of the batch completes.
+ */
+
+int
+Canvas::EIO_AfterRenderBatch(eio_req *req) {
+  HandleScope scope;
+  batch_job_t *job = (batch_job_t *) req->data;
+  batch_closure_t *batch = job->batch;
+  Canvas *canvas = job->canvas;
+
+  if (canvas && !job->status) {
+    canvas->encodeHint[batch->encode.type] = job->output.len;
+    if (!job->hit
+      && !canvas->isRecording()
+      && job->generation == canvas->generation) {
+      if (!job->hashed) canvas->setHash(job->key.hash, job->generation);
+      encode_cache_put(&job->key, job->output.data, job->output.len);
+    }
+  }
+
+  if (--batch->pending) return 0;
+  ev_unref(EV_DEFAULT_UC);
+
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  for (int i = 0; i < batch->count && !status; ++i)
+    status = batch->jobs[i].status;
+
+  if (status) {
+    Local<Value> argv[1] = { Canvas::Error(status) };
+    batch->pfn->Call(Context::GetCurrent()->Global(), 1, argv);
+  } else {
+    Local<Array> buffers = Array::New(batch->count);
+    for (int i = 0; i < batch->count; ++i)
+      buffers->Set(i, outputToBuffer(&batch->jobs[i].output, Handle<Object>()));
+    Local<Value> argv[2] = { Local<Value>::New(Null()), buffers };
+    batch->pfn->Call(Context::GetCurrent()->Global(), 2, argv);
+  }
+
+  for (int i = 0; i < batch->count; ++i) {
+    output_buffer_free(&batch->jobs[i].output);
+    batch->jobs[i].canvas->Unref();
+  }
+
+  batch->pfn.Dispose();
+  free(batch->jobs);
+  free(batch);
+  return 0;
+}
+
+/*
+ * Encode many canvases in one call, invoking `callback`
+ * with an array of Buffers in the order given. Each canvas
+ * is encoded on the thread pool in parallel, recordings
+ * being rasterized at their own dimensions first. Output is
+ * shared with the encode cache as with toBuffer(). Canvases
+ * must not be drawn to until the callback is invoked.
+ *
+ *  - canvases, [type], [options], callback
+ *
+ */
+
+Handle<Value>
+Canvas::RenderBatch(const Arguments &args) {
+  HandleScope scope;
+  const char *err = NULL;
+  int fn = 1;
+
+  if (!args[0]->IsArray())
+    return ThrowException(Exception::TypeError(String::New("array of canvases required")));
+  Local<Array> canvases = Local<Array>::Cast(args[0]);
+  int count = canvases->Length();
+
+  // Mime type
+  encode_type_t type = ENCODE_PNG;
+  if (args[fn]->IsString()) {
+    if ((err = parseEncodeType(args[fn++], &type)))
+      return ThrowException(Exception::TypeError(String::New(err)));
+  }
+
+  // Options
+  encode_options_t encode;
+  if (args[fn]->IsObject() && !args[fn]->IsFunction()) {
+    err = parseEncodeOptions(type, args[fn++], &encode);
+  } else {
+    encode_options_init(&encode, type);
+  }
+  if (err) return ThrowException(Exception::TypeError(String::New(err)));
+
+  if (!args[fn]->IsFunction())
+    return ThrowException(Exception::TypeError(String::New("callback function required")));
+
+  for (int i = 0; i < count; ++i) {
+    Local<Value> val = canvases->Get(i);
+    if (!val->IsObject() || !constructor->HasInstance(val->ToObject()))
+      return ThrowException(Exception::TypeError(String::New("Canvas expected")));
+  }
+
+  // An empty batch still completes through a single no-op job
+  batch_closure_t *batch = (batch_closure_t *) malloc(sizeof(batch_closure_t));
+  batch_job_t *jobs = (batch_job_t *) calloc(count ? count : 1, sizeof(batch_job_t));
+  if (!batch || !jobs) {
+    free(batch);
+    free(jobs);
+    return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
+  }
+
+  batch->pfn = Persistent<Function>::New(Handle<Function>::Cast(args[fn]));
+  batch->encode = encode;
+  batch->jobs = jobs;
+  batch->count = count;
+  batch->pending = count ? count : 1;
+  ev_ref(EV_DEFAULT_UC);
+
+  if (!count) {
+    jobs[0].batch = batch;
+    eio_nop(EIO_PRI_DEFAULT, EIO_AfterRenderBatch, &jobs[0]);
+    return Undefined();
+  }
+
+  for (int i = 0; i < count; ++i) {
+    Canvas *canvas = ObjectWrap::Unwrap<Canvas>(canvases->Get(i)->ToObject());
+    batch_job_t *job = &jobs[i];
+    const uint8_t *cached;
+    unsigned cachedLen;
+
+    job->batch = batch;
+    job->canvas = canvas;
+    job->encode = encode;
+    job->generation = canvas->generation;
+    canvas->Ref();
+
+    // Copied here, recordings may be in several jobs or replayed on the loop
+    if (canvas->isRecording()) {
+      job->recording = tiles_copy_recording(canvas->surface(), canvas->width, canvas->height);
+      if (!job->recording) job->status = CAIRO_STATUS_NO_MEMORY;
+    }
+
+    // Cached output, unknown hashes are computed on the thread pool
+    if (!canvas->isRecording()) {
+      job->key.width = canvas->width;
+      job->key.height = canvas->height;
+      job->key.opts = encode;
+      if ((job->hashed = canvas->knownHash(&job->key.hash))) {
+        job->hit = encode_cache_get(&job->key, &cached, &cachedLen);
+      } else {
+        cairo_surface_flush(canvas->surface());
+      }
+    }
+
+    if (!job->status)
+      job->status = output_buffer_init(&job->output, job->hit ? cachedLen : canvas->encodeHint[type]);
+    if (!job->status && job->hit)
+      job->status = output_buffer_write(&job->output, cached, cachedLen);
+
+    if (job->status || job->hit) {
+      eio_nop(EIO_PRI_DEFAULT, EIO_AfterRenderBatch, job);
+    } else {
+      eio_custom(EIO_RenderBatch, EIO_PRI_DEFAULT, EIO_AfterRenderBatch, job);
+    }
+  }
+
+  return Undefined();
+}
+
 /*
  * Canvas::StreamPNG callback.
  */
@@ -233,21 +1081,29 @@ streamPNG(void *c, const uint8_t *data, unsigned len) {
 
 /*
  * Stream PNG data synchronously.
+ *
+ *  - callback, [options]
+ *
  */
 
 Handle<Value>
 Canvas::StreamPNGSync(const Arguments &args) {
   HandleScope scope;
-  // TODO: async as well
   if (!args[0]->IsFunction())
     return ThrowException(Exception::TypeError(String::New("callback function required")));
 
   Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
   closure_t closure;
+  const char *err = parseEncodeOptions(ENCODE_PNG, args[1], &closure.encode);
+  if (err) return ThrowException(Exception::TypeError(String::New(err)));
+
   closure.fn = Handle<Function>::Cast(args[0]);
 
   TryCatch try_catch;
-  cairo_status_t status = cairo_surface_write_to_png_stream(canvas->surface(), streamPNG, &closure);
+  cairo_status_t status = canvas_encode(canvas->surface(), &closure.encode, streamPNG, &closure);
 
   if (try_catch.HasCaught()) {
     return try_catch.ReThrow();
@@ -264,14 +1120,236 @@ Canvas::StreamPNGSync(const Arguments &args) {
   return Undefined();
 }
 
+/*
+ * Async stream callback, invoked on the eio thread.
+ * Queues a copy of the chunk and wakes the loop.
+ */
+
+static cairo_status_t
+queueChunk(void *c, const uint8_t *data, unsigned len) {
+  stream_closure_t *closure = (stream_closure_t *) c;
+  chunk_t *chunk = (chunk_t *) malloc(sizeof(chunk_t));
+  if (!chunk) return CAIRO_STATUS_NO_MEMORY;
+  chunk->data = (uint8_t *) malloc(len);
+  if (!chunk->data) {
+    free(chunk);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  memcpy(chunk->data, data, len);
+  chunk->len = len;
+  chunk->next = NULL;
+
+  pthread_mutex_lock(&closure->lock);
+  if (closure->tail) {
+    closure->tail->next = chunk;
+  } else {
+    closure->head = chunk;
+  }
+  closure->tail = chunk;
+  pthread_mutex_unlock(&closure->lock);
+
+  ev_async_send(EV_DEFAULT_UC, &closure->async);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/*
+ * Emit queued chunks as "data", on the loop.
+ */
+
+static void
+flushChunks(stream_closure_t *closure) {
+  HandleScope scope;
+
+  pthread_mutex_lock(&closure->lock);
+  chunk_t *chunk = closure->head;
+  closure->head = closure->tail = NULL;
+  pthread_mutex_unlock(&closure->lock);
+
+  while (chunk) {
+    chunk_t *next = chunk->next;
+    Buffer *buf = Buffer::New(chunk->len);
+    memcpy(BUFFER_DATA(buf), chunk->data, chunk->len);
+    Local<Value> argv[3] = {
+        Local<Value>::New(Null())
+      , Local<Value>::New(buf->handle_)
+      , Integer::New(chunk->len) };
+    TryCatch try_catch;
+    closure->pfn->Call(Context::GetCurrent()->Global(), 3, argv);
+    if (try_catch.HasCaught()) FatalException(try_catch);
+    free(chunk->data);
+    free(chunk);
+    chunk = next;
+  }
+}
+
+/*
+ * ev_async callback, flushes chunks while the encode is in flight.
+ */
+
+static void
+onChunk(EV_P_ ev_async *watcher, int revents) {
+  flushChunks((stream_closure_t *) watcher->data);
+}
+
+/*
+ * EIO stream callback.
+ */
+
+int
+Canvas::EIO_Stream(eio_req *req) {
+  stream_closure_t *closure = (stream_closure_t *) req->data;
+
+  closure->status = canvas_encode(
+      closure->canvas->surface()
+    , &closure->encode
+    , queueChunk
+    , closure);
+
+  return 0;
+}
+
+/*
+ * EIO after stream callback. Flushes remaining chunks,
+ * then signals "end" or "error".
+ */
+
+int
+Canvas::EIO_AfterStream(eio_req *req) {
+  HandleScope scope;
+  stream_closure_t *closure = (stream_closure_t *) req->data;
+  ev_async_stop(EV_DEFAULT_UC, &closure->async);
+  ev_unref(EV_DEFAULT_UC);
+
+  flushChunks(closure);
+
+  TryCatch try_catch;
+  if (closure->status) {
+    Local<Value> argv[1] = { Canvas::Error(closure->status) };
+    closure->pfn->Call(Context::GetCurrent()->Global(), 1, argv);
+  } else {
+    Local<Value> argv[3] = {
+        Local<Value>::New(Null())
+      , Local<Value>::New(Null())
+      , Integer::New(0) };
+    closure->pfn->Call(Context::GetCurrent()->Global(), 3, argv);
+  }
+  if (try_catch.HasCaught()) FatalException(try_catch);
+
+  closure->canvas->Unref();
+  closure->pfn.Dispose();
+  pthread_mutex_destroy(&closure->lock);
+  free(closure);
+  return 0;
+}
+
+/*
+ * Stream encoded data asynchronously, encoding on the thread pool
+ * and emitting chunks on the loop as they are produced.
+ *
+ *  - callback, [options]
+ *
+ */
+
+Handle<Value>
+Canvas::Stream(const Arguments &args, encode_type_t type) {
+  HandleScope scope;
+  if (!args[0]->IsFunction())
+    return ThrowException(Exception::TypeError(String::New("callback function required")));
+
+  Canvas *canvas = ObjectWrap::Unwrap<Canvas>(args.This());
+  if (canvas->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
+  encode_options_t encode;
+  const char *err = parseEncodeOptions(type, args[1], &encode);
+  if (err) return ThrowException(Exception::TypeError(String::New(err)));
+
+  stream_closure_t *closure = (stream_closure_t *) malloc(sizeof(stream_closure_t));
+  if (!closure) return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
+  closure->encode = encode;
+  closure->canvas = canvas;
+  closure->status = CAIRO_STATUS_SUCCESS;
+  closure->head = closure->tail = NULL;
+  closure->pfn = Persistent<Function>::New(Handle<Function>::Cast(args[0]));
+  pthread_mutex_init(&closure->lock, NULL);
+  ev_async_init(&closure->async, onChunk);
+  closure->async.data = closure;
+  ev_async_start(EV_DEFAULT_UC, &closure->async);
+
+  canvas->Ref();
+  eio_custom(EIO_Stream, EIO_PRI_DEFAULT, EIO_AfterStream, closure);
+  ev_ref(EV_DEFAULT_UC);
+  return Undefined();
+}
+
+/*
+ * Stream PNG data asynchronously.
+ */
+
+Handle<Value>
+Canvas::StreamPNG(const Arguments &args) {
+  return Stream(args, ENCODE_PNG);
+}
+
+/*
+ * Stream JPEG data asynchronously.
+ */
+
+Handle<Value>
+Canvas::StreamJPEG(const Arguments &args) {
+#ifdef HAVE_JPEG
+  return Stream(args, ENCODE_JPEG);
+#else
+  return ThrowException(Exception::Error(String::New("JPEG support not available")));
+#endif
+}
+
 /*
  * Initialize cairo surface.
  */
 
-Canvas::Canvas(int w, int h): ObjectWrap() {
+Canvas::Canvas(int w, int h, canvas_type_t t, cairo_format_t f): ObjectWrap() {
+  width = w;
+  height = h;
+  type = t;
+  format = f;
+  memset(encodeHint, 0, sizeof(encodeHint));
+  generation = 0;
+  canvas_arena_init(&scratch);
+  _hashed = false;
+  resetDirty();
+  createSurface();
+  memstats_object(MEMSTATS_CANVAS, 1);
+}
+
+/*
+ * Initialize a cairo surface over `buffer`'s memory. Its
+ * contents are unknown so the whole surface starts dirty.
+ */
+
+Canvas::Canvas(Handle<Object> buffer, int w, int h, int stride, cairo_format_t f): ObjectWrap() {
   width = w;
   height = h;
-  _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  type = CANVAS_TYPE_IMAGE;
+  format = f;
+  memset(encodeHint, 0, sizeof(encodeHint));
+  generation = 0;
+  canvas_arena_init(&scratch);
+  _hashed = false;
+  _rawExposed = false;
+  _data = NULL;
+  _bytes = 0;
+  _buffer = Persistent<Object>::New(buffer);
+  _touchedY1 = _touchedY2 = 0;
+  _surface = cairo_image_surface_create_for_data(
+      (uint8_t *) Buffer::Data(buffer)
+    , format
+    , width
+    , height
+    , stride);
+  resetDirty();
+  markDirty(0, 0, width, height);
+  memstats_object(MEMSTATS_CANVAS, 1);
 }
 
 /*
@@ -279,27 +1357,221 @@ Canvas::Canvas(int w, int h): ObjectWrap() {
  */
 
 Canvas::~Canvas() {
+  destroySurface();
+  canvas_arena_free(&scratch);
+  memstats_object(MEMSTATS_CANVAS, -1);
+}
+
+/*
+ * Create the surface over a zeroed block from the surface pool,
+ * falling back to cairo's own allocation.
+ */
+
+void
+Canvas::createSurface() {
+  _rawExposed = false;
+  _touchedY1 = _touchedY2 = 0;
+#if CAIRO_VERSION_MINOR >= 10
+  if (isRecording()) {
+    cairo_rectangle_t extents = { 0, 0, (double) width, (double) height };
+    _surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    _data = NULL;
+    _bytes = 0;
+    return;
+  }
+#endif
+
+  int stride = cairo_format_stride_for_width(format, width);
+  size_t len = (size_t) stride * height;
+  _data = len ? surface_pool_acquire(len, &_capacity) : NULL;
+
+  if (_data) {
+    _surface = cairo_image_surface_create_for_data(
+        _data
+      , format
+      , width
+      , height
+      , stride);
+  } else {
+    _surface = cairo_image_surface_create(format, width, height);
+  }
+
+  _bytes = _data ? _capacity : len;
+  memstats_bytes(MEMSTATS_CANVAS, _bytes);
+}
+
+/*
+ * Destroy the surface, returning its block to the pool
+ * along with the rows drawn to since it was last cleared,
+ * which resetDirty() does not shrink. Blocks
+ * still viewed by raw buffers are freed with the surface,
+ * external memory is left to its Buffer.
+ */
+
+void
+Canvas::destroySurface() {
+  size_t stride = _data ? this->stride() : 0;
+
+  // Raw buffers still view the surface, it frees the block
+  if (_data && rawCount(_surface)) {
+    static cairo_user_data_key_t key;
+    if (!cairo_surface_set_user_data(_surface, &key, _data, free)) _data = NULL;
+  }
+
   cairo_surface_destroy(_surface);
+  memstats_bytes(MEMSTATS_CANVAS, -(long) _bytes);
+  if (!_buffer.IsEmpty()) {
+    _buffer.Dispose();
+    _buffer.Clear();
+  }
+  if (!_data) return;
+
+  // Writes through raw buffers are not tracked
+  if (_rawExposed) {
+    surface_pool_release(_data, _capacity, 0, _capacity);
+  } else {
+    surface_pool_release(_data, _capacity, _touchedY1 * stride, _touchedY2 * stride);
+  }
+  _data = NULL;
+}
+
+/*
+ * Clear the rows drawn to since the last clear in place,
+ * or all of them once raw buffers have been handed out.
+ */
+
+void
+Canvas::clearSurface() {
+  if (_rawExposed) _touchedY1 = 0, _touchedY2 = height;
+  else if (_touchedY1 >= _touchedY2) return;
+  cairo_surface_flush(_surface);
+  int stride = this->stride();
+  memset(data() + _touchedY1 * stride, 0, (_touchedY2 - _touchedY1) * stride);
+  cairo_surface_mark_dirty(_surface);
+  _touchedY1 = _touchedY2 = 0;
 }
 
 /*
- * Re-alloc the surface, destroying the previous.
+ * Re-alloc the surface, destroying the previous. When the
+ * dimensions are unchanged image surfaces are cleared in
+ * place, recordings always start over.
  */
 
 void
 Canvas::resurface(Handle<Object> canvas) {
-  // Re-surface
-  cairo_surface_destroy(_surface);
-  _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  Handle<Value> context = canvas->Get(String::New("context"));
+  Context2d *context2d = context->IsUndefined()
+    ? NULL
+    : ObjectWrap::Unwrap<Context2d>(context->ToObject());
+
+  // The context must not outlive the surface it references
+  if (context2d) cairo_destroy(context2d->context());
+
+  if (!isRecording()
+    && width == cairo_image_surface_get_width(_surface)
+    && height == cairo_image_surface_get_height(_surface)) {
+    clearSurface();
+  } else {
+    destroySurface();
+    createSurface();
+    memset(encodeHint, 0, sizeof(encodeHint));
+  }
+  resetDirty();
+  invalidate();
 
   // Reset context
-  Handle<Value> context = canvas->Get(String::New("context"));
-  if (!context->IsUndefined()) {
-    Context2d *context2d = ObjectWrap::Unwrap<Context2d>(context->ToObject());
-    cairo_t *prev = context2d->context();
-    context2d->setContext(cairo_create(surface()));
-    cairo_destroy(prev);
+  if (context2d) context2d->setContext(cairo_create(surface()));
+}
+
+/*
+ * Add the device-space box to the dirty rectangle, rounding
+ * outwards and clipping to the surface. Boxes entirely off
+ * the surface or with NaN extents, as huge transforms can
+ * produce, leave it and the generation untouched. The
+ * touched rows grow alongside, only a clear shrinks them.
+ */
+
+void
+Canvas::markDirty(double x1, double y1, double x2, double y2) {
+  if (isnan(x1) || isnan(y1) || isnan(x2) || isnan(y2)) return;
+  int ix1 = (int) floor(fmin(fmax(x1, 0), width))
+    , iy1 = (int) floor(fmin(fmax(y1, 0), height))
+    , ix2 = (int) ceil(fmin(fmax(x2, 0), width))
+    , iy2 = (int) ceil(fmin(fmax(y2, 0), height));
+  if (ix1 >= ix2 || iy1 >= iy2) return;
+
+  if (isDirty()) {
+    if (ix1 < _dirtyX1) _dirtyX1 = ix1;
+    if (iy1 < _dirtyY1) _dirtyY1 = iy1;
+    if (ix2 > _dirtyX2) _dirtyX2 = ix2;
+    if (iy2 > _dirtyY2) _dirtyY2 = iy2;
+  } else {
+    _dirtyX1 = ix1;
+    _dirtyY1 = iy1;
+    _dirtyX2 = ix2;
+    _dirtyY2 = iy2;
   }
+
+  if (_touchedY1 < _touchedY2) {
+    if (iy1 < _touchedY1) _touchedY1 = iy1;
+    if (iy2 > _touchedY2) _touchedY2 = iy2;
+  } else {
+    _touchedY1 = iy1;
+    _touchedY2 = iy2;
+  }
+
+  invalidate();
+}
+
+/*
+ * Hash of the surface contents, recomputed only when the
+ * generation has changed. Memory written outside the canvas,
+ * through raw buffers or the Buffer it was created over,
+ * does not bump the generation so is always rehashed.
+ */
+
+uint64_t
+Canvas::contentHash() {
+  if (!knownHash(&_hash)) {
+    cairo_surface_flush(_surface);
+    setHash(hashSurface(), generation);
+  }
+  return _hash;
+}
+
+/*
+ * Hash the surface memory, which must be flushed. Safe
+ * on the thread pool while the canvas is not drawn to.
+ */
+
+uint64_t
+Canvas::hashSurface() {
+  return canvas_hash(data(), (size_t) stride() * height, format);
+}
+
+/*
+ * Store the current hash in `hash` when it is known
+ * without hashing the surface.
+ */
+
+bool
+Canvas::knownHash(uint64_t *hash) {
+  if (!_hashed || _hashGeneration != generation || isUntracked()) return false;
+  *hash = _hash;
+  return true;
+}
+
+/*
+ * Remember `hash`, computed at `generation`, unless
+ * the canvas has since changed.
+ */
+
+void
+Canvas::setHash(uint64_t hash, uint32_t generation) {
+  if (generation != this->generation) return;
+  _hash = hash;
+  _hashGeneration = generation;
+  _hashed = true;
 }
 
 /*
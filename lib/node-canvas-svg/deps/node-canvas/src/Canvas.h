@@ -12,19 +12,29 @@
 #include <node.h>
 #include <node_object_wrap.h>
 #include <cairo.h>
+#include "encoder.h"
+#include "arena.h"
 
 using namespace v8;
 using namespace node;
 
 /*
- * Maxmimum states per context.
- * TODO: remove/resize
+ * Initial state stack slots per context, doubled as needed.
  */
 
-#ifndef CANVAS_MAX_STATES
-#define CANVAS_MAX_STATES 64
+#ifndef CANVAS_INITIAL_STATES
+#define CANVAS_INITIAL_STATES 16
 #endif
 
+/*
+ * Canvas surface types.
+ */
+
+typedef enum {
+    CANVAS_TYPE_IMAGE
+  , CANVAS_TYPE_RECORDING
+} canvas_type_t;
+
 /*
  * Canvas.
  */
@@ -33,27 +43,84 @@ class Canvas: public node::ObjectWrap {
   public:
     int width;
     int height;
+    canvas_type_t type;
+    cairo_format_t format;
+    size_t encodeHint[ENCODE_TYPES];
+    uint32_t generation;
+    canvas_arena_t scratch;
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static Handle<Value> New(const Arguments &args);
+    static Handle<Value> NewForData(const Arguments &args);
     static Handle<Value> ToBuffer(const Arguments &args);
     static Handle<Value> GetWidth(Local<String> prop, const AccessorInfo &info);
     static Handle<Value> GetHeight(Local<String> prop, const AccessorInfo &info);
     static void SetWidth(Local<String> prop, Local<Value> val, const AccessorInfo &info);
     static void SetHeight(Local<String> prop, Local<Value> val, const AccessorInfo &info);
+    static Handle<Value> GetGeneration(Local<String> prop, const AccessorInfo &info);
+    static Handle<Value> GetType(Local<String> prop, const AccessorInfo &info);
+    static Handle<Value> GetFormat(Local<String> prop, const AccessorInfo &info);
+    static Handle<Value> GetStride(Local<String> prop, const AccessorInfo &info);
+    static Handle<Value> GetRawBuffer(const Arguments &args);
+    static Handle<Value> ContentHash(const Arguments &args);
+    static Handle<Value> GetDirtyRect(const Arguments &args);
+    static Handle<Value> ResetDirty(const Arguments &args);
+    static Handle<Value> MarkDirty(const Arguments &args);
+    static Handle<Value> PoolStats(const Arguments &args);
+    static Handle<Value> ConfigurePool(const Arguments &args);
+    static Handle<Value> MemoryStats(const Arguments &args);
+    static Handle<Value> RenderBatch(const Arguments &args);
+    static Handle<Value> StreamPNG(const Arguments &args);
     static Handle<Value> StreamPNGSync(const Arguments &args);
+    static Handle<Value> StreamJPEG(const Arguments &args);
     static Local<Value> Error(cairo_status_t status);
     static int EIO_ToBuffer(eio_req *req);
     static int EIO_AfterToBuffer(eio_req *req);
+    static int EIO_RenderBatch(eio_req *req);
+    static int EIO_AfterRenderBatch(eio_req *req);
+    static Handle<Value> Stream(const Arguments &args, encode_type_t type);
+    static int EIO_Stream(eio_req *req);
+    static int EIO_AfterStream(eio_req *req);
     inline cairo_surface_t *surface(){ return _surface; }
     inline uint8_t *data(){ return cairo_image_surface_get_data(_surface); }
     inline int stride(){ return cairo_image_surface_get_stride(_surface); }
-    Canvas(int width, int height);
+    inline bool isRecording(){ return CANVAS_TYPE_RECORDING == type; }
+    inline void invalidate(){ ++generation; }
+    inline bool isDirty(){ return _dirtyX1 < _dirtyX2; }
+    inline bool isUntracked(){ return _rawExposed || !_buffer.IsEmpty(); }
+    inline void resetDirty(){ _dirtyX1 = _dirtyY1 = _dirtyX2 = _dirtyY2 = 0; }
+    void markDirty(double x1, double y1, double x2, double y2);
+    uint64_t contentHash();
+    uint64_t hashSurface();
+    bool knownHash(uint64_t *hash);
+    void setHash(uint64_t hash, uint32_t generation);
+    Canvas(int width, int height
+      , canvas_type_t type = CANVAS_TYPE_IMAGE
+      , cairo_format_t format = CAIRO_FORMAT_ARGB32);
+    Canvas(Handle<Object> buffer, int width, int height
+      , int stride, cairo_format_t format);
     void resurface(Handle<Object> canvas);
 
   private:
     ~Canvas();
+    void createSurface();
+    void destroySurface();
+    void clearSurface();
     cairo_surface_t *_surface;
+    uint8_t *_data;
+    Persistent<Object> _buffer;
+    size_t _capacity;
+    size_t _bytes;
+    uint64_t _hash;
+    uint32_t _hashGeneration;
+    bool _hashed;
+    bool _rawExposed;
+    int _dirtyX1;
+    int _dirtyY1;
+    int _dirtyX2;
+    int _dirtyY2;
+    int _touchedY1;
+    int _touchedY2;
 };
 
 #endif
@@ -8,6 +8,7 @@
 #include "color.h"
 #include "Canvas.h"
 #include "CanvasGradient.h"
+#include "memstats.h"
 
 Persistent<FunctionTemplate> Gradient::constructor;
 
@@ -90,6 +91,8 @@ Gradient::AddColorStop(const Arguments &args) {
       , color.g
       , color.b
       , color.a);
+    ++grad->_stops;
+    memstats_bytes(MEMSTATS_GRADIENT, MEMSTATS_COLOR_STOP_BYTES);
   }
 
   return Undefined();
@@ -100,8 +103,9 @@ Gradient::AddColorStop(const Arguments &args) {
  */
 
 Gradient::Gradient(double x0, double y0, double x1, double y1):
-  _x0(x0), _y0(y0), _x1(x1), _y1(y1) {
+  _x0(x0), _y0(y0), _x1(x1), _y1(y1), _stops(0) {
   _pattern = cairo_pattern_create_linear(x0, y0, x1, y1);
+  memstats_object(MEMSTATS_GRADIENT, 1);
 }
 
 /*
@@ -109,8 +113,9 @@ Gradient::Gradient(double x0, double y0, double x1, double y1):
  */
 
 Gradient::Gradient(double x0, double y0, double r0, double x1, double y1, double r1):
-  _x0(x0), _y0(y0), _x1(x1), _y1(y1), _r0(r0), _r1(r1) {
+  _x0(x0), _y0(y0), _x1(x1), _y1(y1), _r0(r0), _r1(r1), _stops(0) {
   _pattern = cairo_pattern_create_radial(x0, y0, r0, x1, y1, r1);
+  memstats_object(MEMSTATS_GRADIENT, 1);
 }
 
 /*
@@ -119,4 +124,6 @@ Gradient::Gradient(double x0, double y0, double r0, double x1, double y1, double
 
 Gradient::~Gradient() {
   cairo_pattern_destroy(_pattern);
+  memstats_bytes(MEMSTATS_GRADIENT, -(long) _stops * MEMSTATS_COLOR_STOP_BYTES);
+  memstats_object(MEMSTATS_GRADIENT, -1);
 }
@@ -23,6 +23,7 @@ class Gradient: public node::ObjectWrap {
   private:
     ~Gradient();
     double _x0, _y0, _x1, _y1, _r0, _r1;
+    int _stops;
     cairo_pattern_t *_pattern;
 };
 
@@ -14,6 +14,13 @@
 #include "ImageData.h"
 #include "CanvasRenderingContext2d.h"
 #include "CanvasGradient.h"
+#include "memstats.h"
+#include "tiles.h"
+#include "format.h"
+#include "premultiply.h"
+#include "blur.h"
+#include "hash.h"
+#include "shadowcache.h"
 
 Persistent<FunctionTemplate> Context2d::constructor;
 
@@ -60,9 +67,11 @@ Context2d::Initialize(Handle<Object> target) {
   // Prototype
   Local<ObjectTemplate> proto = constructor->PrototypeTemplate();
   NODE_SET_PROTOTYPE_METHOD(constructor, "drawImage", DrawImage);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "drawRecording", DrawRecording);
   NODE_SET_PROTOTYPE_METHOD(constructor, "putImageData", PutImageData);
   NODE_SET_PROTOTYPE_METHOD(constructor, "save", Save);
   NODE_SET_PROTOTYPE_METHOD(constructor, "restore", Restore);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "resetScratch", ResetScratch);
   NODE_SET_PROTOTYPE_METHOD(constructor, "rotate", Rotate);
   NODE_SET_PROTOTYPE_METHOD(constructor, "translate", Translate);
   NODE_SET_PROTOTYPE_METHOD(constructor, "transform", Transform);
@@ -92,6 +101,9 @@ Context2d::Initialize(Handle<Object> target) {
   NODE_SET_PROTOTYPE_METHOD(constructor, "setFont", SetFont);
   NODE_SET_PROTOTYPE_METHOD(constructor, "setFillColor", SetFillColor);
   NODE_SET_PROTOTYPE_METHOD(constructor, "setStrokeColor", SetStrokeColor);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "setFillRGBA", SetFillRGBA);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "setStrokeRGBA", SetStrokeRGBA);
+  NODE_SET_PROTOTYPE_METHOD(constructor, "setShadowRGBA", SetShadowRGBA);
   NODE_SET_PROTOTYPE_METHOD(constructor, "setFillPattern", SetFillPattern);
   NODE_SET_PROTOTYPE_METHOD(constructor, "setStrokePattern", SetStrokePattern);
   proto->SetAccessor(String::NewSymbol("patternQuality"), GetPatternQuality, SetPatternQuality);
@@ -119,7 +131,11 @@ Context2d::Context2d(Canvas *canvas) {
   _canvas = canvas;
   _context = cairo_create(canvas->surface());
   cairo_set_line_width(_context, 1);
-  state = states[stateno = 0] = (canvas_state_t *) malloc(sizeof(canvas_state_t));
+  stateSlots = CANVAS_INITIAL_STATES;
+  states = (canvas_state_t *) malloc(stateSlots * sizeof(canvas_state_t));
+  state = &states[stateno = 0];
+  memstats_object(MEMSTATS_CONTEXT2D, 1);
+  memstats_bytes(MEMSTATS_CONTEXT2D, stateSlots * sizeof(canvas_state_t));
   state->shadowBlur = 0;
   state->shadowOffsetX = state->shadowOffsetY = 0;
   state->globalAlpha = 1;
@@ -132,6 +148,7 @@ Context2d::Context2d(Canvas *canvas) {
   state->stroke = transparent;
   state->shadow = transparent_black;
   state->patternQuality = CAIRO_FILTER_GOOD;
+  canvas_blur_scratch_init(&_blurScratch);
 }
 
 /*
@@ -139,49 +156,96 @@ Context2d::Context2d(Canvas *canvas) {
  */
 
 Context2d::~Context2d() {
+  while (stateno) restoreState();
+  setFillPattern(NULL);
+  setStrokePattern(NULL);
+  free(states);
+  memstats_bytes(MEMSTATS_CONTEXT2D, -(long) (stateSlots * sizeof(canvas_state_t) + _blurScratch.len));
+  memstats_object(MEMSTATS_CONTEXT2D, -1);
+  canvas_blur_scratch_free(&_blurScratch);
   cairo_destroy(_context);
 }
 
 /*
- * Save cairo / canvas state.
+ * Save cairo / canvas state, saving neither when the
+ * state stack cannot grow so the two stay in step.
  */
 
-void
+bool
 Context2d::save() {
+  if (!saveState()) return false;
   cairo_save(_context);
-  saveState();
+  return true;
 }
 
 /*
- * Restore cairo / canvas state.
+ * Restore cairo / canvas state, ignoring unbalanced
+ * restores as cairo would otherwise fail the context.
  */
 
 void
 Context2d::restore() {
+  if (0 == stateno) return;
   cairo_restore(_context);
   restoreState();
 }
 
 /*
- * Save the current state.
+ * Save the current state, copying it to the next slot. The
+ * stack doubles when full and its slots are reused, so
+ * balanced save / restore pairs do not allocate. Returns
+ * false, leaving the state as is, when out of memory.
  */
 
-void
+bool
 Context2d::saveState() {
-  if (stateno == CANVAS_MAX_STATES) return;
-  states[++stateno] = (canvas_state_t *) malloc(sizeof(canvas_state_t));
-  memcpy(states[stateno], state, sizeof(canvas_state_t));
-  state = states[stateno];
+  if (stateno + 1 == stateSlots) {
+    canvas_state_t *grown = (canvas_state_t *) realloc(states, stateSlots * 2 * sizeof(canvas_state_t));
+    if (!grown) return false;
+    memstats_bytes(MEMSTATS_CONTEXT2D, stateSlots * sizeof(canvas_state_t));
+    states = grown;
+    stateSlots *= 2;
+  }
+  states[stateno + 1] = states[stateno];
+  state = &states[++stateno];
+  if (state->fillPattern) cairo_pattern_reference(state->fillPattern);
+  if (state->strokePattern) cairo_pattern_reference(state->strokePattern);
+  return true;
 }
 
 /*
- * Restore state.
+ * Restore state, releasing the patterns of the popped slot.
  */
 
 void
 Context2d::restoreState() {
   if (0 == stateno) return;
-  state = states[--stateno];
+  setFillPattern(NULL);
+  setStrokePattern(NULL);
+  state = &states[--stateno];
+}
+
+/*
+ * Set the fill pattern, referencing it for as long as
+ * the state holds it. NULL fills with the fill colour.
+ */
+
+void
+Context2d::setFillPattern(cairo_pattern_t *pattern) {
+  if (pattern) cairo_pattern_reference(pattern);
+  if (state->fillPattern) cairo_pattern_destroy(state->fillPattern);
+  state->fillPattern = pattern;
+}
+
+/*
+ * Set the stroke pattern, see setFillPattern().
+ */
+
+void
+Context2d::setStrokePattern(cairo_pattern_t *pattern) {
+  if (pattern) cairo_pattern_reference(pattern);
+  if (state->strokePattern) cairo_pattern_destroy(state->strokePattern);
+  state->strokePattern = pattern;
 }
 
 /*
@@ -201,6 +265,83 @@ Context2d::savePath() {
 void
 Context2d::restorePath() {
   cairo_append_path(_context, _path);
+  cairo_path_destroy(_path);
+}
+
+/*
+ * Bounding box in device space of the user-space box.
+ */
+
+void
+Context2d::userToDevice(double *x1, double *y1, double *x2, double *y2) {
+  double xs[4] = { *x1, *x2, *x1, *x2 }
+    , ys[4] = { *y1, *y1, *y2, *y2 };
+  for (int i = 0; i < 4; ++i) {
+    cairo_user_to_device(_context, &xs[i], &ys[i]);
+    if (!i || xs[i] < *x1) *x1 = xs[i];
+    if (!i || ys[i] < *y1) *y1 = ys[i];
+  }
+  *x2 = xs[0], *y2 = ys[0];
+  for (int i = 1; i < 4; ++i) {
+    if (xs[i] > *x2) *x2 = xs[i];
+    if (ys[i] > *y2) *y2 = ys[i];
+  }
+}
+
+/*
+ * Convert the user-space box about to be drawn to the
+ * device-space box it affects, including the shadow when
+ * `shadow` is set. Operators unbounded by the mask affect
+ * the whole clip.
+ */
+
+void
+Context2d::drawExtents(double *x1, double *y1, double *x2, double *y2, bool shadow) {
+  double cx1, cy1, cx2, cy2;
+  cairo_clip_extents(_context, &cx1, &cy1, &cx2, &cy2);
+  userToDevice(&cx1, &cy1, &cx2, &cy2);
+
+  switch (cairo_get_operator(_context)) {
+    case CAIRO_OPERATOR_IN:
+    case CAIRO_OPERATOR_OUT:
+    case CAIRO_OPERATOR_DEST_IN:
+    case CAIRO_OPERATOR_DEST_ATOP:
+      *x1 = cx1, *y1 = cy1, *x2 = cx2, *y2 = cy2;
+      return;
+    default:
+      break;
+  }
+
+  userToDevice(x1, y1, x2, y2);
+
+  // Shadow is offset in user space and spread by
+  // up to three passes of the box blur
+  if (shadow) {
+    double ox = state->shadowOffsetX
+      , oy = state->shadowOffsetY
+      , spread = state->shadowBlur * 3;
+    cairo_user_to_device_distance(_context, &ox, &oy);
+    *x1 = fmin(*x1, *x1 + ox) - spread;
+    *y1 = fmin(*y1, *y1 + oy) - spread;
+    *x2 = fmax(*x2, *x2 + ox) + spread;
+    *y2 = fmax(*y2, *y2 + oy) + spread;
+  }
+
+  *x1 = fmax(*x1, cx1);
+  *y1 = fmax(*y1, cy1);
+  *x2 = fmin(*x2, cx2);
+  *y2 = fmin(*y2, cy2);
+}
+
+/*
+ * Mark the user-space box about to be drawn as dirty,
+ * see drawExtents().
+ */
+
+void
+Context2d::markDirty(double x1, double y1, double x2, double y2, bool shadow) {
+  drawExtents(&x1, &y1, &x2, &y2, shadow);
+  _canvas->markDirty(x1, y1, x2, y2);
 }
 
 /*
@@ -209,6 +350,9 @@ Context2d::restorePath() {
 
 void
 Context2d::fill(bool preserve) {
+  double x1, y1, x2, y2;
+  cairo_fill_extents(_context, &x1, &y1, &x2, &y2);
+  markDirty(x1, y1, x2, y2, hasShadow());
   if (state->fillPattern) {
     cairo_pattern_set_filter(state->fillPattern, state->patternQuality);
     cairo_set_source(_context, state->fillPattern);
@@ -218,11 +362,11 @@ Context2d::fill(bool preserve) {
 
   if (preserve) {
     hasShadow()
-      ? shadow(cairo_fill_preserve)
+      ? shadow(cairo_fill_preserve, x1, y1, x2, y2)
       : cairo_fill_preserve(_context);
   } else {
     hasShadow()
-      ? shadow(cairo_fill)
+      ? shadow(cairo_fill, x1, y1, x2, y2)
       : cairo_fill(_context);
   }
 }
@@ -233,30 +377,181 @@ Context2d::fill(bool preserve) {
 
 void
 Context2d::stroke(bool preserve) {
+  double x1, y1, x2, y2;
+  cairo_stroke_extents(_context, &x1, &y1, &x2, &y2);
+  markDirty(x1, y1, x2, y2, hasShadow());
   if (state->strokePattern) {
     cairo_pattern_set_filter(state->strokePattern, state->patternQuality);
-    cairo_set_source(_context, state->fillPattern);
+    cairo_set_source(_context, state->strokePattern);
   } else {
     setSourceRGBA(state->stroke);
   }
 
   if (preserve) {
     hasShadow()
-      ? shadow(cairo_stroke_preserve)
+      ? shadow(cairo_stroke_preserve, x1, y1, x2, y2)
       : cairo_stroke_preserve(_context);
   } else {
     hasShadow()
-      ? shadow(cairo_stroke)
+      ? shadow(cairo_stroke, x1, y1, x2, y2)
       : cairo_stroke(_context);
   }
 }
 
 /*
- * Apply shadow with the given draw fn.
+ * Drawing parameters affecting a shadow mask, zeroed
+ * before use so that it may be hashed.
+ */
+
+typedef struct {
+  double matrix[4];
+  double lineWidth;
+  double miterLimit;
+  double dashOffset;
+  double tolerance;
+  int stroke;
+  int fillRule;
+  int lineCap;
+  int lineJoin;
+  int dashes;
+  int antialias;
+} shadow_params_t;
+
+/*
+ * Hash the geometry of `path` in device space relative to
+ * `ox`, `oy` and the parameters `cr` would draw it with,
+ * so that shapes differing only by a whole pixel
+ * translation share a mask.
+ */
+
+static uint64_t
+hashShadow(cairo_t *cr, canvas_arena_t *scratch, cairo_path_t *path, bool stroke, int ox, int oy) {
+  shadow_params_t params;
+  cairo_matrix_t matrix;
+  memset(&params, 0, sizeof(params));
+  cairo_get_matrix(cr, &matrix);
+  params.matrix[0] = matrix.xx;
+  params.matrix[1] = matrix.yx;
+  params.matrix[2] = matrix.xy;
+  params.matrix[3] = matrix.yy;
+  params.tolerance = cairo_get_tolerance(cr);
+  params.antialias = cairo_get_antialias(cr);
+  params.stroke = stroke;
+  if (stroke) {
+    params.lineWidth = cairo_get_line_width(cr);
+    params.miterLimit = cairo_get_miter_limit(cr);
+    params.lineCap = cairo_get_line_cap(cr);
+    params.lineJoin = cairo_get_line_join(cr);
+    params.dashes = cairo_get_dash_count(cr);
+  } else {
+    params.fillRule = cairo_get_fill_rule(cr);
+  }
+
+  uint64_t hash = canvas_hash(&params, sizeof(params), 0);
+  canvas_arena_mark_t mark = canvas_arena_mark(scratch);
+  double *dashes;
+  if (params.dashes
+    && (dashes = (double *) canvas_arena_alloc(scratch, params.dashes * sizeof(double)))) {
+    cairo_get_dash(cr, dashes, &params.dashOffset);
+    hash = canvas_hash(dashes, params.dashes * sizeof(double), hash);
+    hash = canvas_hash(&params.dashOffset, sizeof(double), hash);
+  }
+  canvas_arena_release(scratch, mark);
+
+  for (int i = 0; i < path->num_data; i += path->data[i].header.length) {
+    cairo_path_data_t *data = &path->data[i];
+    double entry[2] = { (double) data->header.type, 0 };
+    hash = canvas_hash(entry, sizeof(entry), hash);
+    for (int j = 1; j < data->header.length; ++j) {
+      entry[0] = data[j].point.x;
+      entry[1] = data[j].point.y;
+      cairo_user_to_device(cr, &entry[0], &entry[1]);
+      entry[0] -= ox;
+      entry[1] -= oy;
+      hash = canvas_hash(entry, sizeof(entry), hash);
+    }
+  }
+  return hash;
+}
+
+/*
+ * Return the blurred coverage of `path` drawn with `fn`,
+ * from the shadow cache or rendered into an A8 surface
+ * positioned at `ox`, `oy` in device space. The user-space
+ * box x1, y1, x2, y2, spread by the blur, is the mask's
+ * extent, limited to where it can reach the clip. NULL
+ * when nothing is visible.
+ */
+
+cairo_surface_t *
+Context2d::shadowMask(
+    void (fn)(cairo_t *cr)
+  , cairo_path_t *path
+  , double x1, double y1, double x2, double y2
+  , int *ox, int *oy) {
+  double cx1, cy1, cx2, cy2
+    , spread = state->shadowBlur * 3;
+  cairo_clip_extents(_context, &cx1, &cy1, &cx2, &cy2);
+  userToDevice(&cx1, &cy1, &cx2, &cy2);
+  userToDevice(&x1, &y1, &x2, &y2);
+
+  int ix1 = (int) floor(fmax(x1, cx1 - spread) - spread)
+    , iy1 = (int) floor(fmax(y1, cy1 - spread) - spread)
+    , ix2 = (int) ceil(fmin(x2, cx2 + spread) + spread)
+    , iy2 = (int) ceil(fmin(y2, cy2 + spread) + spread);
+  if (ix1 >= ix2 || iy1 >= iy2) return NULL;
+
+  bool stroke = cairo_stroke == fn || cairo_stroke_preserve == fn;
+  shadow_cache_key_t key;
+  key.hash = hashShadow(_context, &_canvas->scratch, path, stroke, ix1, iy1);
+  key.width = ix2 - ix1;
+  key.height = iy2 - iy1;
+  key.radius = state->shadowBlur;
+  *ox = ix1;
+  *oy = iy1;
+
+  cairo_surface_t *mask = shadow_cache_get(&key);
+  if (mask) return mask;
+
+  // Render with the context's transform and parameters
+  mask = cairo_image_surface_create(CAIRO_FORMAT_A8, key.width, key.height);
+  cairo_t *cr = cairo_create(mask);
+  cairo_matrix_t matrix;
+  cairo_get_matrix(_context, &matrix);
+  cairo_translate(cr, -ix1, -iy1);
+  cairo_transform(cr, &matrix);
+  cairo_set_tolerance(cr, cairo_get_tolerance(_context));
+  cairo_set_antialias(cr, cairo_get_antialias(_context));
+  cairo_set_fill_rule(cr, cairo_get_fill_rule(_context));
+  cairo_set_line_width(cr, cairo_get_line_width(_context));
+  cairo_set_line_cap(cr, cairo_get_line_cap(_context));
+  cairo_set_line_join(cr, cairo_get_line_join(_context));
+  cairo_set_miter_limit(cr, cairo_get_miter_limit(_context));
+  canvas_arena_mark_t mark = canvas_arena_mark(&_canvas->scratch);
+  int dashes = cairo_get_dash_count(_context);
+  double *dash, offset;
+  if (dashes
+    && (dash = (double *) canvas_arena_alloc(&_canvas->scratch, dashes * sizeof(double)))) {
+    cairo_get_dash(_context, dash, &offset);
+    cairo_set_dash(cr, dash, dashes, offset);
+  }
+  canvas_arena_release(&_canvas->scratch, mark);
+  cairo_append_path(cr, path);
+  fn(cr);
+  cairo_destroy(cr);
+
+  if (state->shadowBlur) blur(mask, state->shadowBlur);
+  shadow_cache_put(&key, mask);
+  return mask;
+}
+
+/*
+ * Apply shadow with the given draw fn, drawing the
+ * user-space box x1, y1, x2, y2.
  */
 
 void
-Context2d::shadow(void (fn)(cairo_t *cr)) {
+Context2d::shadow(void (fn)(cairo_t *cr), double x1, double y1, double x2, double y2) {
   cairo_path_t *path = cairo_copy_path_flat(_context);
   cairo_save(_context);
 
@@ -266,22 +561,31 @@ Context2d::shadow(void (fn)(cairo_t *cr)) {
     , state->shadowOffsetX
     , state->shadowOffsetY);
 
-  // Apply shadow
-  cairo_push_group(_context);
-  cairo_new_path(_context);
-  cairo_append_path(_context, path);
-  setSourceRGBA(state->shadow);
-  fn(_context);
-
-  // No need to invoke blur if shadowBlur is 0
-  if (state->shadowBlur) {
-    blur(cairo_get_group_target(_context), state->shadowBlur);
+  if (CAIRO_SURFACE_TYPE_IMAGE == cairo_surface_get_type(cairo_get_group_target(_context))) {
+    // Paint the shadow colour through the blurred coverage
+    int ox, oy;
+    cairo_surface_t *mask = shadowMask(fn, path, x1, y1, x2, y2, &ox, &oy);
+    if (mask) {
+      cairo_identity_matrix(_context);
+      setSourceRGBA(state->shadow);
+      cairo_mask_surface(_context, mask, ox, oy);
+      cairo_surface_destroy(mask);
+    }
+  } else {
+    // Recordings have no pixels to blur, record the
+    // coverage unblurred
+    cairo_push_group_with_content(_context, CAIRO_CONTENT_ALPHA);
+    cairo_set_operator(_context, CAIRO_OPERATOR_OVER);
+    cairo_new_path(_context);
+    cairo_append_path(_context, path);
+    cairo_set_source_rgba(_context, 0, 0, 0, 1);
+    fn(_context);
+    cairo_pattern_t *mask = cairo_pop_group(_context);
+    setSourceRGBA(state->shadow);
+    cairo_mask(_context, mask);
+    cairo_pattern_destroy(mask);
   }
 
-  // Paint the shadow
-  cairo_pop_group_to_source(_context);
-  cairo_paint(_context);
-
   // Restore state
   cairo_restore(_context);
   cairo_new_path(_context);
@@ -316,66 +620,24 @@ Context2d::hasShadow() {
 }
 
 /*
- * Blur the given surface with the given radius.
+ * Blur the given image surface with the given radius,
+ * reusing the context's scratch memory.
  */
 
 void
 Context2d::blur(cairo_surface_t *surface, int radius) {
-  // Steve Hanov, 2009
-  // Released into the public domain.
-  --radius;
-  // get width, height
-  int width = cairo_image_surface_get_width( surface );
-  int height = cairo_image_surface_get_height( surface );
-  unsigned* precalc = 
-      (unsigned*)malloc(width*height*sizeof(unsigned));
-  unsigned char* src = cairo_image_surface_get_data( surface );
-  double mul=1.f/((radius*2)*(radius*2));
-  int channel;
-  
-  // The number of times to perform the averaging. According to wikipedia,
-  // three iterations is good enough to pass for a gaussian.
-  const int MAX_ITERATIONS = 3; 
-  int iteration;
-
-  for ( iteration = 0; iteration < MAX_ITERATIONS; iteration++ ) {
-      for( channel = 0; channel < 4; channel++ ) {
-          int x,y;
-
-          // precomputation step.
-          unsigned char* pix = src;
-          unsigned* pre = precalc;
-
-          pix += channel;
-          for (y=0;y<height;y++) {
-              for (x=0;x<width;x++) {
-                  int tot=pix[0];
-                  if (x>0) tot+=pre[-1];
-                  if (y>0) tot+=pre[-width];
-                  if (x>0 && y>0) tot-=pre[-width-1];
-                  *pre++=tot;
-                  pix += 4;
-              }
-          }
-
-          // blur step.
-          pix = src + (int)radius * width * 4 + (int)radius * 4 + channel;
-          for (y=radius;y<height-radius;y++) {
-              for (x=radius;x<width-radius;x++) {
-                  int l = x < radius ? 0 : x - radius;
-                  int t = y < radius ? 0 : y - radius;
-                  int r = x + radius >= width ? width - 1 : x + radius;
-                  int b = y + radius >= height ? height - 1 : y + radius;
-                  int tot = precalc[r+b*width] + precalc[l+t*width] - 
-                      precalc[l+b*width] - precalc[r+t*width];
-                  *pix=(unsigned char)(tot*mul);
-                  pix += 4;
-              }
-              pix += (int)radius * 2 * 4;
-          }
-      }
-  }
-  free( precalc );
+  size_t before = _blurScratch.len;
+  cairo_surface_flush(surface);
+  canvas_blur(
+      cairo_image_surface_get_data(surface)
+    , cairo_image_surface_get_width(surface)
+    , cairo_image_surface_get_height(surface)
+    , cairo_image_surface_get_stride(surface)
+    , CAIRO_FORMAT_A8 == cairo_image_surface_get_format(surface) ? 1 : 4
+    , radius
+    , &_blurScratch);
+  cairo_surface_mark_dirty(surface);
+  memstats_bytes(MEMSTATS_CONTEXT2D, (long) _blurScratch.len - (long) before);
 }
 
 /*
@@ -411,6 +673,9 @@ Context2d::PutImageData(const Arguments &args) {
     return ThrowException(Exception::TypeError(String::New("ImageData expected")));
 
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  if (context->canvas()->isRecording())
+    return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
   ImageData *imageData = ObjectWrap::Unwrap<ImageData>(obj);
   PixelArray *arr = imageData->pixelArray();
   
@@ -455,35 +720,36 @@ Context2d::PutImageData(const Arguments &args) {
       return ThrowException(Exception::Error(String::New("invalid arguments")));
   }
 
+  // Formats other than ARGB32 are converted a row at a time
+  cairo_format_t format = context->canvas()->format;
+  canvas_arena_t *scratch = &context->canvas()->scratch;
+  canvas_arena_mark_t mark = canvas_arena_mark(scratch);
+  int bpp = canvas_format_bpp(format);
+  uint32_t *tmp = NULL;
+  if (CAIRO_FORMAT_ARGB32 != format
+    && !(tmp = (uint32_t *) canvas_arena_alloc(scratch, cols * 4)))
+    return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
+
+  cairo_surface_flush(context->canvas()->surface());
+
   uint8_t *srcRows = src + sy * srcStride + sx * 4;
   for (int y = 0; y < rows; ++y) {
-    uint32_t *row = (uint32_t *)(dst + dstStride * (y + dy));
-    for (int x = 0; x < cols; ++x) {
-      int bx = x * 4;
-      uint32_t *pixel = row + x + dx;
-
-      // RGBA
-      uint8_t a = srcRows[bx + 3];
-      uint8_t r = srcRows[bx + 0];
-      uint8_t g = srcRows[bx + 1];
-      uint8_t b = srcRows[bx + 2];
-      float alpha = (float) a / 255;
-
-      // ARGB
-      *pixel = a << 24
-        | (int)((float) r * alpha) << 16
-        | (int)((float) g * alpha) << 8
-        | (int)((float) b * alpha);
-    }
+    uint8_t *dstRow = dst + dstStride * (y + dy) + dx * bpp;
+    uint32_t *row = tmp ? tmp : (uint32_t *) dstRow;
+    canvas_premultiply(srcRows, row, cols);
+    if (tmp) canvas_format_from_argb32(format, tmp, dstRow, cols);
     srcRows += srcStride;
   }
 
+  canvas_arena_release(scratch, mark);
+
   cairo_surface_mark_dirty_rectangle(
       context->canvas()->surface()
     , dx
     , dy
     , cols
     , rows);
+  context->canvas()->markDirty(dx, dy, dx + cols, dy + rows);
 
   return Undefined();
 }
@@ -553,6 +819,8 @@ Context2d::DrawImage(const Arguments &args) {
       return ThrowException(Exception::TypeError(String::New("invalid arguments")));
   }
 
+  context->markDirty(dx, dy, dx + dw, dy + dh);
+
   // Start draw
   cairo_save(ctx);
 
@@ -587,6 +855,136 @@ Context2d::DrawImage(const Arguments &args) {
   return Undefined();
 }
 
+/*
+ * Replay `recording` in tiles across threads, returning
+ * false when the context cannot be tiled so that the caller
+ * replays it through the context instead. The clip must be
+ * representable as rectangles.
+ */
+
+static bool
+replayTiled(Context2d *context, Canvas *recording, double x, double y, double scale, tiles_options_t *opts, cairo_status_t *status) {
+  cairo_t *ctx = context->context();
+  Canvas *canvas = context->canvas();
+  if (opts->threads < 2 || canvas->isRecording()) return false;
+
+  // Clip in device space
+  cairo_save(ctx);
+  cairo_identity_matrix(ctx);
+  cairo_rectangle_list_t *clip = cairo_copy_clip_rectangle_list(ctx);
+  cairo_restore(ctx);
+  if (clip->status) {
+    cairo_rectangle_list_destroy(clip);
+    return false;
+  }
+
+  tiles_replay_t replay;
+  cairo_save(ctx);
+  cairo_translate(ctx, x, y);
+  cairo_scale(ctx, scale, scale);
+  cairo_get_matrix(ctx, &replay.matrix);
+  cairo_restore(ctx);
+
+  double x1 = x, y1 = y
+    , x2 = x + recording->width * scale
+    , y2 = y + recording->height * scale;
+  context->drawExtents(&x1, &y1, &x2, &y2);
+  if (isnan(x1) || isnan(y1) || isnan(x2) || isnan(y2)) {
+    cairo_rectangle_list_destroy(clip);
+    return false;
+  }
+  replay.x = (int) floor(fmin(fmax(x1, 0), canvas->width));
+  replay.y = (int) floor(fmin(fmax(y1, 0), canvas->height));
+  replay.w = (int) ceil(fmin(fmax(x2, 0), canvas->width)) - replay.x;
+  replay.h = (int) ceil(fmin(fmax(y2, 0), canvas->height)) - replay.y;
+
+  replay.source = recording->surface();
+  replay.width = recording->width;
+  replay.height = recording->height;
+  replay.op = cairo_get_operator(ctx);
+  replay.filter = context->state->patternQuality;
+  replay.alpha = context->state->globalAlpha;
+  replay.clip = clip;
+
+  *status = tiles_replay(canvas->surface(), &replay, opts);
+  cairo_rectangle_list_destroy(clip);
+  return true;
+}
+
+/*
+ * Replay a recording canvas onto the context, with its
+ * origin at (x, y) and scaled by the optional `scale`.
+ *
+ * Passing `threads` greater than 1 in `options` replays
+ * it in `tileSize` tiles concurrently, each tile with a
+ * cairo_t of its own over the canvas memory.
+ *
+ *  - recording
+ *  - recording, x, y
+ *  - recording, x, y, scale
+ *  - recording, x, y, scale, options
+ *
+ */
+
+Handle<Value>
+Context2d::DrawRecording(const Arguments &args) {
+  HandleScope scope;
+
+  Local<Object> obj = args[0]->ToObject();
+  if (!Canvas::constructor->HasInstance(obj))
+    return ThrowException(Exception::TypeError(String::New("Canvas expected")));
+
+  Canvas *recording = ObjectWrap::Unwrap<Canvas>(obj);
+  if (!recording->isRecording())
+    return ThrowException(Exception::TypeError(String::New("recording Canvas expected")));
+
+  Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  if (recording == context->canvas())
+    return ThrowException(Exception::Error(String::New("cannot replay a recording onto itself")));
+
+  double x = args[1]->IsNumber() ? args[1]->NumberValue() : 0
+    , y = args[2]->IsNumber() ? args[2]->NumberValue() : 0
+    , scale = args[3]->IsNumber() ? args[3]->NumberValue() : 1;
+
+  if (scale <= 0) return Undefined();
+
+  tiles_options_t opts;
+  tiles_options_init(&opts);
+  if (args[4]->IsObject()) {
+    Local<Object> obj = args[4]->ToObject();
+    Local<Value> val;
+    val = obj->Get(String::NewSymbol("tileSize"));
+    if (val->IsNumber()) opts.size = val->Int32Value();
+    val = obj->Get(String::NewSymbol("threads"));
+    if (val->IsNumber()) opts.threads = val->Int32Value();
+  }
+
+  context->markDirty(
+      x
+    , y
+    , x + recording->width * scale
+    , y + recording->height * scale);
+
+  cairo_status_t status;
+  if (replayTiled(context, recording, x, y, scale, &opts, &status)) {
+    if (status) return ThrowException(Canvas::Error(status));
+    return Undefined();
+  }
+
+  cairo_t *ctx = context->context();
+  cairo_save(ctx);
+  cairo_translate(ctx, x, y);
+  cairo_scale(ctx, scale, scale);
+  cairo_set_source_surface(ctx, recording->surface(), 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(ctx), context->state->patternQuality);
+  cairo_rectangle(ctx, 0, 0, recording->width, recording->height);
+  cairo_clip(ctx);
+  cairo_paint_with_alpha(ctx, context->state->globalAlpha);
+  cairo_restore(ctx);
+
+  return Undefined();
+}
+
 /*
  * Get global alpha.
  */
@@ -1013,7 +1411,7 @@ Context2d::SetFillPattern(const Arguments &args) {
 
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
   Gradient *grad = ObjectWrap::Unwrap<Gradient>(obj);
-  context->state->fillPattern = grad->pattern();
+  context->setFillPattern(grad->pattern());
   return Undefined();
 }
 
@@ -1031,7 +1429,7 @@ Context2d::SetStrokePattern(const Arguments &args) {
 
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
   Gradient *grad = ObjectWrap::Unwrap<Gradient>(obj);
-  context->state->strokePattern = grad->pattern();
+  context->setStrokePattern(grad->pattern());
   return Undefined();
 }
 
@@ -1062,6 +1460,79 @@ Context2d::GetShadowColor(Local<String> prop, const AccessorInfo &info) {
   return String::New(buf);
 }
 
+/*
+ * Populate `color` from either (r, g, b[, a]) with channels
+ * in 0..255 and alpha in 0..1, or a single uint32 packed as
+ * 0xRRGGBBAA. False when a component is not a number.
+ */
+
+static bool
+parseRGBA(const Arguments &args, rgba_t *color) {
+  if (1 == args.Length()) {
+    if (!args[0]->IsNumber()) return false;
+    *color = rgba_create(args[0]->Uint32Value());
+    return true;
+  }
+
+  double c[4] = { 0, 0, 0, 1 };
+  int n = args.Length() < 4 ? args.Length() : 4;
+  if (n < 3) return false;
+  for (int i = 0; i < n; ++i) {
+    if (!args[i]->IsNumber()) return false;
+    c[i] = args[i]->NumberValue();
+    if (isnan(c[i])) return false;
+  }
+  color->r = fmin(fmax(c[0], 0), 255) / 255;
+  color->g = fmin(fmax(c[1], 0), 255) / 255;
+  color->b = fmin(fmax(c[2], 0), 255) / 255;
+  color->a = fmin(fmax(c[3], 0), 1);
+  return true;
+}
+
+/*
+ * Set the fill color from numbers, see parseRGBA().
+ */
+
+Handle<Value>
+Context2d::SetFillRGBA(const Arguments &args) {
+  HandleScope scope;
+  rgba_t color;
+  if (!parseRGBA(args, &color)) return Undefined();
+  Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  context->setFillPattern(NULL);
+  context->state->fill = color;
+  return Undefined();
+}
+
+/*
+ * Set the stroke color from numbers, see parseRGBA().
+ */
+
+Handle<Value>
+Context2d::SetStrokeRGBA(const Arguments &args) {
+  HandleScope scope;
+  rgba_t color;
+  if (!parseRGBA(args, &color)) return Undefined();
+  Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  context->setStrokePattern(NULL);
+  context->state->stroke = color;
+  return Undefined();
+}
+
+/*
+ * Set the shadow color from numbers, see parseRGBA().
+ */
+
+Handle<Value>
+Context2d::SetShadowRGBA(const Arguments &args) {
+  HandleScope scope;
+  rgba_t color;
+  if (!parseRGBA(args, &color)) return Undefined();
+  Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  context->state->shadow = color;
+  return Undefined();
+}
+
 /*
  * Set fill color, used internally for fillStyle=
  */
@@ -1075,19 +1546,20 @@ Context2d::SetFillColor(const Arguments &args) {
   uint32_t rgba = rgba_from_string(*str, &ok);
   if (!ok) return Undefined();
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
-  context->state->fillPattern = NULL;
+  context->setFillPattern(NULL);
   context->state->fill = rgba_create(rgba);
   return Undefined();
 }
 
 /*
- * Get fill color.
+ * Get fill color, null while filling with a pattern.
  */
 
 Handle<Value>
 Context2d::GetFillColor(Local<String> prop, const AccessorInfo &info) {
   char buf[64];
   Context2d *context = ObjectWrap::Unwrap<Context2d>(info.This());
+  if (context->state->fillPattern) return Null();
   rgba_to_string(context->state->fill, buf);
   return String::New(buf);
 }
@@ -1105,19 +1577,20 @@ Context2d::SetStrokeColor(const Arguments &args) {
   uint32_t rgba = rgba_from_string(*str, &ok);
   if (!ok) return Undefined();
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
-  context->state->strokePattern = NULL;
+  context->setStrokePattern(NULL);
   context->state->stroke = rgba_create(rgba);
   return Undefined();
 }
 
 /*
- * Get stroke color.
+ * Get stroke color, null while stroking with a pattern.
  */
 
 Handle<Value>
 Context2d::GetStrokeColor(Local<String> prop, const AccessorInfo &info) {
   char buf[64];
   Context2d *context = ObjectWrap::Unwrap<Context2d>(info.This());
+  if (context->state->strokePattern) return Null();
   rgba_to_string(context->state->stroke, buf);
   return String::New(buf);
 }
@@ -1190,7 +1663,8 @@ Handle<Value>
 Context2d::Save(const Arguments &args) {
   HandleScope scope;
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
-  context->save();
+  if (!context->save())
+    return ThrowException(Canvas::Error(CAIRO_STATUS_NO_MEMORY));
   return Undefined();
 }
 
@@ -1206,6 +1680,19 @@ Context2d::Restore(const Arguments &args) {
   return Undefined();
 }
 
+/*
+ * Reset the canvas scratch arena, keeping its memory for
+ * reuse. Allocations held by pending encodes survive.
+ */
+
+Handle<Value>
+Context2d::ResetScratch(const Arguments &args) {
+  HandleScope scope;
+  Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
+  canvas_arena_reset(&context->canvas()->scratch);
+  return Undefined();
+}
+
 /*
  * Creates a new subpath.
  */
@@ -1634,8 +2121,9 @@ Context2d::ClearRect(const Arguments &args) {
   Context2d *context = ObjectWrap::Unwrap<Context2d>(args.This());
   cairo_t *ctx = context->context();
   cairo_save(ctx);
-  cairo_rectangle(ctx, x, y, width, height);
   cairo_set_operator(ctx, CAIRO_OPERATOR_CLEAR);
+  context->markDirty(x, y, x + width, y + height);
+  cairo_rectangle(ctx, x, y, width, height);
   cairo_fill(ctx);
   cairo_restore(ctx);
   return Undefined();
@@ -11,6 +11,7 @@
 #include "color.h"
 #include "Canvas.h"
 #include "CanvasGradient.h"
+#include "blur.h"
 
 /*
  * State struct.
@@ -36,17 +37,20 @@ typedef struct {
 
 class Context2d: public node::ObjectWrap {
   public:
-    short stateno;
-    canvas_state_t *states[CANVAS_MAX_STATES];
+    int stateno;
+    int stateSlots;
+    canvas_state_t *states;
     canvas_state_t *state;
     Context2d(Canvas *canvas);
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static Handle<Value> New(const Arguments &args);
     static Handle<Value> DrawImage(const Arguments &args);
+    static Handle<Value> DrawRecording(const Arguments &args);
     static Handle<Value> PutImageData(const Arguments &args);
     static Handle<Value> Save(const Arguments &args);
     static Handle<Value> Restore(const Arguments &args);
+    static Handle<Value> ResetScratch(const Arguments &args);
     static Handle<Value> Rotate(const Arguments &args);
     static Handle<Value> Translate(const Arguments &args);
     static Handle<Value> Scale(const Arguments &args);
@@ -63,6 +67,9 @@ class Context2d: public node::ObjectWrap {
     static Handle<Value> SetFont(const Arguments &args);
     static Handle<Value> SetFillColor(const Arguments &args);
     static Handle<Value> SetStrokeColor(const Arguments &args);
+    static Handle<Value> SetFillRGBA(const Arguments &args);
+    static Handle<Value> SetStrokeRGBA(const Arguments &args);
+    static Handle<Value> SetShadowRGBA(const Arguments &args);
     static Handle<Value> SetFillPattern(const Arguments &args);
     static Handle<Value> SetStrokePattern(const Arguments &args);
     static Handle<Value> SetTextBaseline(const Arguments &args);
@@ -111,16 +118,26 @@ class Context2d: public node::ObjectWrap {
     void inline setSourceRGBA(rgba_t color);
     void setTextPath(const char *str, double x, double y);
     void blur(cairo_surface_t *surface, int radius);
-    void shadow(void (fn)(cairo_t *cr));
+    void shadow(void (fn)(cairo_t *cr), double x1, double y1, double x2, double y2);
+    cairo_surface_t *shadowMask(
+        void (fn)(cairo_t *cr)
+      , cairo_path_t *path
+      , double x1, double y1, double x2, double y2
+      , int *ox, int *oy);
     void shadowStart();
     void shadowApply();
     void savePath();
     void restorePath();
-    void saveState();
+    bool saveState();
     void restoreState();
+    void setFillPattern(cairo_pattern_t *pattern);
+    void setStrokePattern(cairo_pattern_t *pattern);
+    void userToDevice(double *x1, double *y1, double *x2, double *y2);
+    void drawExtents(double *x1, double *y1, double *x2, double *y2, bool shadow = false);
+    void markDirty(double x1, double y1, double x2, double y2, bool shadow = false);
     void fill(bool preserve = false);
     void stroke(bool preserve = false);
-    void save();
+    bool save();
     void restore();
 
   private:
@@ -128,6 +145,7 @@ class Context2d: public node::ObjectWrap {
     Canvas *_canvas;
     cairo_t *_context;
     cairo_path_t *_path;
+    canvas_blur_scratch_t _blurScratch;
 };
 
 #endif
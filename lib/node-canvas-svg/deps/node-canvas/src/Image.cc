@@ -7,6 +7,8 @@
 
 #include "Canvas.h"
 #include "Image.h"
+#include "memstats.h"
+#include "arena.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -17,6 +19,12 @@
 
 Persistent<FunctionTemplate> Image::constructor;
 
+/*
+ * Scratch memory for decoding, images load on the loop thread.
+ */
+
+static canvas_arena_t scratch;
+
 /*
  * Initialize Image.
  */
@@ -94,7 +102,8 @@ Image::GetSrc(Local<String>, const AccessorInfo &info) {
 }
 
 /*
- * Set src path.
+ * Set src path, reusing the previous path's memory
+ * when large enough.
  */
 
 void
@@ -102,7 +111,14 @@ Image::SetSrc(Local<String>, Local<Value> val, const AccessorInfo &info) {
   if (val->IsString()) {
     String::AsciiValue src(val);
     Image *img = ObjectWrap::Unwrap<Image>(info.This());
-    img->filename = strdup(*src);
+    size_t len = src.length() + 1;
+    if (len > img->_filenameSize) {
+      char *grown = (char *) realloc(img->filename, len);
+      if (!grown) return;
+      img->filename = grown;
+      img->_filenameSize = len;
+    }
+    memcpy(img->filename, *src, len);
     img->load();
   }
 }
@@ -157,9 +173,12 @@ Image::SetOnerror(Local<String>, Local<Value> val, const AccessorInfo &info) {
 
 Image::Image() {
   filename = NULL;
+  _filenameSize = 0;
   _surface = NULL;
+  _bytes = 0;
   width = height = 0;
   state = DEFAULT;
+  memstats_object(MEMSTATS_IMAGE, 1);
 }
 
 /*
@@ -167,8 +186,22 @@ Image::Image() {
  */
 
 Image::~Image() {
-  if (_surface) cairo_surface_destroy(_surface);
+  destroySurface();
   if (filename) free(filename);
+  memstats_object(MEMSTATS_IMAGE, -1);
+}
+
+/*
+ * Destroy the surface of a previous load, if any.
+ */
+
+void
+Image::destroySurface() {
+  if (!_surface) return;
+  cairo_surface_destroy(_surface);
+  memstats_bytes(MEMSTATS_IMAGE, -(long) _bytes);
+  _surface = NULL;
+  _bytes = 0;
 }
 
 /*
@@ -240,13 +273,22 @@ Image::error(Local<Value> err) {
 
 cairo_status_t
 Image::loadSurface() {
+  cairo_status_t status = CAIRO_STATUS_READ_ERROR;
+  destroySurface();
+
   switch (extension(filename)) {
-    case Image::PNG: return loadPNG();
+    case Image::PNG: status = loadPNG(); break;
 #ifdef HAVE_JPEG
-    case Image::JPEG: return loadJPEG();
+    case Image::JPEG: status = loadJPEG(); break;
 #endif
   }
-  return CAIRO_STATUS_READ_ERROR;
+
+  if (CAIRO_STATUS_SUCCESS == status) {
+    _bytes = (size_t) stride() * height;
+    memstats_bytes(MEMSTATS_IMAGE, _bytes);
+  }
+
+  return status;
 }
 
 /*
@@ -293,11 +335,16 @@ Image::loadJPEG() {
 
   // Data alloc
   int stride = width * 4;
+  canvas_arena_mark_t mark = canvas_arena_mark(&scratch);
   uint8_t *data = (uint8_t *) malloc(width * height * 4);
-  if (!data) return CAIRO_STATUS_NO_MEMORY;
-  
-  uint8_t *src = (uint8_t *) malloc(width * 3);
-  if (!src) return CAIRO_STATUS_NO_MEMORY;
+  uint8_t *src = (uint8_t *) canvas_arena_alloc(&scratch, width * 3);
+  if (!data || !src) {
+    free(data);
+    canvas_arena_release(&scratch, mark);
+    fclose(stream);
+    jpeg_destroy_decompress(&info);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
 
   // Copy RGB -> ARGB
   for (int y = 0; y < height; ++y) {
@@ -322,11 +369,18 @@ Image::loadJPEG() {
     , cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width));
 
   // Cleanup
-  free(src);
+  canvas_arena_release(&scratch, mark);
   fclose(stream);
   jpeg_finish_decompress(&info);
   jpeg_destroy_decompress(&info);
   cairo_status_t status = cairo_surface_status(_surface);
+
+  // The surface does not own its data, release it with the surface
+  if (!status) {
+    static cairo_user_data_key_t key;
+    status = cairo_surface_set_user_data(_surface, &key, data, free);
+  }
+
   if (status) free(data);
   return status;
 }
@@ -32,6 +32,7 @@ class Image: public node::ObjectWrap {
     inline uint8_t *data(){ return cairo_image_surface_get_data(_surface); } 
     inline int stride(){ return cairo_image_surface_get_stride(_surface); } 
     cairo_status_t loadSurface();
+    void destroySurface();
     cairo_status_t loadPNG();
 #ifdef HAVE_JPEG
     cairo_status_t loadJPEG();
@@ -58,6 +59,8 @@ class Image: public node::ObjectWrap {
   
   private:
     cairo_surface_t *_surface;
+    size_t _bytes;
+    size_t _filenameSize;
     ~Image();
 };
 
@@ -6,6 +6,9 @@
 //
 
 #include "PixelArray.h"
+#include "memstats.h"
+#include "format.h"
+#include "premultiply.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -53,6 +56,9 @@ PixelArray::New(const Arguments &args) {
         return ThrowException(Exception::TypeError(String::New("Canvas expected")));
 
       Canvas *canvas = ObjectWrap::Unwrap<Canvas>(obj);
+      if (canvas->isRecording())
+        return ThrowException(Exception::Error(String::New("recording canvases have no pixels, replay with drawRecording()")));
+
       arr = new PixelArray(
           canvas
         , args[1]->Int32Value()
@@ -65,6 +71,11 @@ PixelArray::New(const Arguments &args) {
       return ThrowException(Exception::TypeError(String::New("invalid arguments")));
   }
 
+  if (cairo_status_t status = arr->status()) {
+    delete arr;
+    return ThrowException(Canvas::Error(status));
+  }
+
   // Let v8 handle accessors (and clamping)
   args.This()->SetIndexedPropertiesToPixelData(
       arr->data()
@@ -86,6 +97,10 @@ PixelArray::GetLength(Local<String> prop, const AccessorInfo &info) {
 /*
  * Initialize a new PixelArray copying data
  * from the canvas surface using the given rect.
+ * Formats other than ARGB32 are converted a row
+ * at a time, see canvas_format_to_argb32(), then
+ * unpremultiplied by canvas_unpremultiply(). Sets the
+ * status when out of memory.
  */
 
 PixelArray::PixelArray(Canvas *canvas, int sx, int sy, int width, int height):
@@ -93,28 +108,35 @@ PixelArray::PixelArray(Canvas *canvas, int sx, int sy, int width, int height):
 
   // Alloc space for our new data
   uint8_t *dst = alloc();
+  if (!dst) return;
   uint8_t *src = canvas->data();
   int srcStride = canvas->stride()
-    , dstStride = stride();
+    , dstStride = stride()
+    , bpp = canvas_format_bpp(canvas->format);
+
+  canvas_arena_mark_t mark = canvas_arena_mark(&canvas->scratch);
+  uint32_t *tmp = NULL;
+  if (CAIRO_FORMAT_ARGB32 != canvas->format
+    && !(tmp = (uint32_t *) canvas_arena_alloc(&canvas->scratch, width * 4))) {
+    _status = CAIRO_STATUS_NO_MEMORY;
+    return;
+  }
+
+  cairo_surface_flush(canvas->surface());
 
   // Normalize data (argb -> rgba)
   for (int y = 0; y < height; ++y) {
-    uint32_t *row = (uint32_t *)(src + srcStride * (y + sy));
-    for (int x = 0; x < width; ++x) {
-      int bx = x * 4;
-      uint32_t *pixel = row + x + sx;
-      uint8_t a = *pixel >> 24;
-      uint8_t r = *pixel >> 16;
-      uint8_t g = *pixel >> 8;
-      uint8_t b = *pixel;
-      dst[bx + 3] = a;
-      float alpha = (float) a / 255;
-      dst[bx + 0] = (int)((float) r / alpha);
-      dst[bx + 1] = (int)((float) g / alpha);
-      dst[bx + 2] = (int)((float) b / alpha);
+    uint8_t *srcRow = src + srcStride * (y + sy) + sx * bpp;
+    uint32_t *row = (uint32_t *) srcRow;
+    if (tmp) {
+      canvas_format_to_argb32(canvas->format, srcRow, tmp, width);
+      row = tmp;
     }
+    canvas_unpremultiply(row, dst, width);
     dst += dstStride;
   }
+
+  canvas_arena_release(&canvas->scratch, mark);
 }
 
 /*
@@ -128,14 +150,17 @@ PixelArray::PixelArray(int width, int height):
 
 /*
  * Allocate / zero data buffer. Hint mem adjustment.
+ * NULL with the status set when out of memory.
  */
 
 uint8_t *
 PixelArray::alloc() {
   int len = length();
-  _data = (uint8_t *) malloc(len);
-  memset(_data, 0, len);
-  V8::AdjustAmountOfExternalAllocatedMemory(len);
+  _status = CAIRO_STATUS_SUCCESS;
+  if (!(_data = (uint8_t *) malloc(len ? len : 1))) _status = CAIRO_STATUS_NO_MEMORY;
+  else memset(_data, 0, len);
+  memstats_object(MEMSTATS_PIXELARRAY, 1);
+  memstats_bytes(MEMSTATS_PIXELARRAY, len);
   return _data;
 }
 
@@ -144,6 +169,7 @@ PixelArray::alloc() {
  */
 
 PixelArray::~PixelArray() {
-  V8::AdjustAmountOfExternalAllocatedMemory(-length());
+  memstats_bytes(MEMSTATS_PIXELARRAY, -length());
+  memstats_object(MEMSTATS_PIXELARRAY, -1);
   free(_data);
 }
@@ -21,12 +21,14 @@ class PixelArray: public node::ObjectWrap {
     inline int height(){ return _height; }
     inline int stride(){ return _width * 4; }
     inline uint8_t *data(){ return _data; }
+    inline cairo_status_t status(){ return _status; }
     PixelArray(Canvas *canvas, int x, int y, int width, int height);
     PixelArray(int width, int height);
     ~PixelArray();
   private:
     uint8_t *alloc();
     uint8_t *_data;
+    cairo_status_t _status;
     int _width, _height;
 };
 
@@ -0,0 +1,189 @@
+//
+// arena.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "arena.h"
+#include <stdlib.h>
+
+/*
+ * Round `n` up to a multiple of `m`.
+ */
+
+#define ROUND_UP(n, m) (((n) + (m) - 1) / (m) * (m))
+
+/*
+ * Block header size, keeping data aligned.
+ */
+
+#define HEADER ROUND_UP(sizeof(canvas_arena_block_t), CANVAS_ARENA_ALIGN)
+
+/*
+ * Counters across all arenas. Arenas are only
+ * touched from the loop thread.
+ */
+
+static canvas_arena_stats_t totals;
+
+/*
+ * Allocate a block of `size` data bytes on top of `prev`.
+ */
+
+static canvas_arena_block_t *
+block_new(canvas_arena_t *arena, size_t size) {
+  canvas_arena_block_t *block = (canvas_arena_block_t *) malloc(HEADER + size);
+  if (!block) return NULL;
+  block->prev = arena->block;
+  block->size = size;
+  block->used = 0;
+  arena->block = block;
+  arena->bytes += size;
+  ++totals.mallocs;
+  ++totals.blocks;
+  totals.bytes += size;
+  return block;
+}
+
+/*
+ * Free the top block.
+ */
+
+static void
+block_free(canvas_arena_t *arena) {
+  canvas_arena_block_t *block = arena->block;
+  arena->block = block->prev;
+  arena->used -= block->used;
+  arena->bytes -= block->size;
+  --totals.blocks;
+  totals.bytes -= block->size;
+  free(block);
+}
+
+/*
+ * Once empty, replace a chain of blocks by a single
+ * block large enough for the peak seen so far.
+ */
+
+static void
+compact(canvas_arena_t *arena) {
+  if (arena->used || !arena->peak) return;
+  if (arena->block && !arena->block->prev && arena->block->size >= arena->peak) return;
+  while (arena->block) block_free(arena);
+  block_new(arena, ROUND_UP(arena->peak, CANVAS_ARENA_BLOCK));
+}
+
+/*
+ * Initialize an empty arena.
+ */
+
+void
+canvas_arena_init(canvas_arena_t *arena) {
+  arena->block = NULL;
+  arena->used = 0;
+  arena->peak = 0;
+  arena->bytes = 0;
+  arena->holds = 0;
+}
+
+/*
+ * Free all blocks of `arena`.
+ */
+
+void
+canvas_arena_free(canvas_arena_t *arena) {
+  while (arena->block) block_free(arena);
+  canvas_arena_init(arena);
+}
+
+/*
+ * Allocate `len` bytes, aligned to CANVAS_ARENA_ALIGN.
+ * NULL when out of memory.
+ */
+
+void *
+canvas_arena_alloc(canvas_arena_t *arena, size_t len) {
+  canvas_arena_block_t *block = arena->block;
+  len = ROUND_UP(len ? len : 1, CANVAS_ARENA_ALIGN);
+
+  if (!block || block->used + len > block->size) {
+    size_t size = len > CANVAS_ARENA_BLOCK ? len : CANVAS_ARENA_BLOCK;
+    if (block && block->size * 2 > size) size = block->size * 2;
+    if (!(block = block_new(arena, size))) return NULL;
+  }
+
+  void *ptr = (uint8_t *) block + HEADER + block->used;
+  block->used += len;
+  arena->used += len;
+  if (arena->used > arena->peak) arena->peak = arena->used;
+  return ptr;
+}
+
+/*
+ * Return the current position of `arena`.
+ */
+
+canvas_arena_mark_t
+canvas_arena_mark(canvas_arena_t *arena) {
+  canvas_arena_mark_t mark;
+  mark.block = arena->block;
+  mark.used = arena->block ? arena->block->used : 0;
+  return mark;
+}
+
+/*
+ * Release everything allocated since `mark`.
+ */
+
+void
+canvas_arena_release(canvas_arena_t *arena, canvas_arena_mark_t mark) {
+  while (arena->block != mark.block) block_free(arena);
+  if (arena->block) {
+    arena->used -= arena->block->used - mark.used;
+    arena->block->used = mark.used;
+  }
+  compact(arena);
+}
+
+/*
+ * Release everything, unless allocations are held
+ * by pending work, see canvas_arena_hold().
+ */
+
+void
+canvas_arena_reset(canvas_arena_t *arena) {
+  if (arena->holds) return;
+  canvas_arena_mark_t mark = { arena->block, 0 };
+  while (mark.block && mark.block->prev) mark.block = mark.block->prev;
+  canvas_arena_release(arena, mark);
+}
+
+/*
+ * Keep allocations alive across resets until a
+ * matching canvas_arena_drop().
+ */
+
+void
+canvas_arena_hold(canvas_arena_t *arena) {
+  ++arena->holds;
+}
+
+/*
+ * Drop a hold, resetting once none remain.
+ */
+
+void
+canvas_arena_drop(canvas_arena_t *arena) {
+  if (arena->holds) --arena->holds;
+  canvas_arena_reset(arena);
+}
+
+/*
+ * Populate `stats` with the counters across all arenas.
+ * `mallocs` counts every block taken from the heap.
+ */
+
+void
+canvas_arena_stats(canvas_arena_stats_t *stats) {
+  *stats = totals;
+}
@@ -0,0 +1,102 @@
+//
+// arena.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_ARENA_H__
+#define __NODE_ARENA_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Smallest block requested from the heap.
+ */
+
+#ifndef CANVAS_ARENA_BLOCK
+#define CANVAS_ARENA_BLOCK 4096
+#endif
+
+/*
+ * Alignment of arena allocations.
+ */
+
+#define CANVAS_ARENA_ALIGN 16
+
+/*
+ * Arena block, data follows the header.
+ */
+
+typedef struct canvas_arena_block {
+  struct canvas_arena_block *prev;
+  size_t size;
+  size_t used;
+} canvas_arena_block_t;
+
+/*
+ * Bump allocator for transient allocations. Memory is
+ * reclaimed only by releasing to a mark or resetting,
+ * and the blocks are kept for reuse, so a workload that
+ * fits its arena does not touch the heap.
+ */
+
+typedef struct {
+  canvas_arena_block_t *block;
+  size_t used;
+  size_t peak;
+  size_t bytes;
+  unsigned holds;
+} canvas_arena_t;
+
+/*
+ * Position to release back to.
+ */
+
+typedef struct {
+  canvas_arena_block_t *block;
+  size_t used;
+} canvas_arena_mark_t;
+
+/*
+ * Counters across all arenas.
+ */
+
+typedef struct {
+  unsigned long mallocs;
+  unsigned long bytes;
+  unsigned blocks;
+} canvas_arena_stats_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_arena_init(canvas_arena_t *arena);
+
+void
+canvas_arena_free(canvas_arena_t *arena);
+
+void *
+canvas_arena_alloc(canvas_arena_t *arena, size_t len);
+
+canvas_arena_mark_t
+canvas_arena_mark(canvas_arena_t *arena);
+
+void
+canvas_arena_release(canvas_arena_t *arena, canvas_arena_mark_t mark);
+
+void
+canvas_arena_reset(canvas_arena_t *arena);
+
+void
+canvas_arena_hold(canvas_arena_t *arena);
+
+void
+canvas_arena_drop(canvas_arena_t *arena);
+
+void
+canvas_arena_stats(canvas_arena_stats_t *stats);
+
+#endif /* __NODE_ARENA_H__ */
@@ -0,0 +1,571 @@
+//
+// blur.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "blur.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(CANVAS_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_X86_KERNELS 1
+#include <emmintrin.h>
+#endif
+
+#if !defined(CANVAS_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Each pass is a horizontal then a vertical box of
+ * d = 2r + 1 pixels, sliding a running sum along the row
+ * or down the columns so the cost is independent of r.
+ * Pixels beyond the edges are transparent. All channels
+ * of a pixel are summed together, the vertical pass a
+ * whole row at a time.
+ *
+ * Sums are at most 255 * d, within 16 bits for r up to
+ * CANVAS_BLUR_MAX_BOX. Division by d is a multiply by
+ * the 16-bit reciprocal rounded up, saturated to 255:
+ *
+ *   (sum + d / 2) * mul >> 16, mul = ceil(65536 / d)
+ *
+ * Single channel rows have no lanes to spread over, so
+ * the SIMD kernels take 8 pixels at a time as prefix sums
+ * of the window changes added to the running sum.
+ *
+ * Every kernel produces identical output.
+ */
+
+/*
+ * Kernel.
+ */
+
+typedef struct {
+  const char *name;
+  void (*hrow)(const uint8_t *pad, uint8_t *dst, int width, int channels, int r, uint16_t half, uint16_t mul);
+  void (*vrow)(const uint8_t *add, const uint8_t *sub, uint16_t *sums, uint8_t *dst, int n, uint16_t half, uint16_t mul);
+  int (*supported)();
+} kernel_t;
+
+/*
+ * Round `n` up to a multiple of 16.
+ */
+
+static inline size_t
+align16(size_t n) {
+  return (n + 15) & ~(size_t) 15;
+}
+
+/*
+ * Scalar kernels.
+ */
+
+static inline uint8_t
+divide(uint32_t sum, uint16_t half, uint16_t mul) {
+  uint32_t q = ((sum + half) * mul) >> 16;
+  return q > 255 ? 255 : q;
+}
+
+/*
+ * Blur a row of `width` pixels from `pad`, the row with
+ * r transparent pixels either side plus one more on the
+ * right, into `dst`.
+ */
+
+static void
+hrowScalar(const uint8_t *pad, uint8_t *dst, int width, int channels, int r, uint16_t half, uint16_t mul) {
+  int sum[4] = { 0, 0, 0, 0 }
+    , n = (2 * r + 1) * channels;
+  for (int i = 0; i < n; ++i) sum[i % channels] += pad[i];
+
+  const uint8_t *in = pad + n
+    , *out = pad;
+  for (int x = 0; x < width; ++x) {
+    for (int c = 0; c < channels; ++c) {
+      *dst++ = divide(sum[c], half, mul);
+      sum[c] += *in++ - *out++;
+    }
+  }
+}
+
+/*
+ * Write the column sums to `dst`, then slide the
+ * window down adding row `add` and dropping `sub`.
+ */
+
+static void
+vrowScalar(const uint8_t *add, const uint8_t *sub, uint16_t *sums, uint8_t *dst, int n, uint16_t half, uint16_t mul) {
+  for (int i = 0; i < n; ++i) {
+    dst[i] = divide(sums[i], half, mul);
+    sums[i] += add[i] - sub[i];
+  }
+}
+
+static int
+supportedScalar() {
+  return 1;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * Load the 4 channels at `p` into 16-bit lanes.
+ */
+
+static inline __m128i
+load4(const uint8_t *p) {
+  int pixel;
+  memcpy(&pixel, p, 4);
+  return _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), _mm_setzero_si128());
+}
+
+/*
+ * Blur a single channel row, 8 pixels at a time.
+ */
+
+static void
+hrow1SSE2(const uint8_t *pad, uint8_t *dst, int width, int r, uint16_t half, uint16_t mul) {
+  int d = 2 * r + 1
+    , sum = 0
+    , x = 0;
+  for (int i = 0; i < d; ++i) sum += pad[i];
+
+  const uint8_t *in = pad + d;
+  __m128i zero = _mm_setzero_si128()
+    , vhalf = _mm_set1_epi16(half)
+    , vmul = _mm_set1_epi16(mul)
+    , base = _mm_set1_epi16(sum);
+  for (; x + 8 <= width; x += 8) {
+    __m128i v = _mm_sub_epi16(
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in + x)), zero)
+      , _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pad + x)), zero));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+    __m128i sums = _mm_add_epi16(base, _mm_slli_si128(v, 2))
+      , q = _mm_mulhi_epu16(_mm_add_epi16(sums, vhalf), vmul)
+      , last = _mm_shufflehi_epi16(v, 0xff);
+    _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(q, q));
+    base = _mm_add_epi16(base, _mm_unpackhi_epi64(last, last));
+  }
+
+  sum = _mm_cvtsi128_si32(base) & 0xffff;
+  for (; x < width; ++x) {
+    dst[x] = divide(sum, half, mul);
+    sum += in[x] - pad[x];
+  }
+}
+
+static void
+hrowSSE2(const uint8_t *pad, uint8_t *dst, int width, int channels, int r, uint16_t half, uint16_t mul) {
+  if (1 == channels) return hrow1SSE2(pad, dst, width, r, half, mul);
+  if (4 != channels) return hrowScalar(pad, dst, width, channels, r, half, mul);
+
+  __m128i vhalf = _mm_set1_epi16(half)
+    , vmul = _mm_set1_epi16(mul)
+    , sum = _mm_setzero_si128();
+  int d = 2 * r + 1;
+  for (int i = 0; i < d; ++i) sum = _mm_add_epi16(sum, load4(pad + i * 4));
+
+  const uint8_t *in = pad + d * 4
+    , *out = pad;
+  for (int x = 0; x < width; ++x, in += 4, out += 4, dst += 4) {
+    __m128i q = _mm_mulhi_epu16(_mm_add_epi16(sum, vhalf), vmul);
+    int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(q, q));
+    memcpy(dst, &pixel, 4);
+    sum = _mm_sub_epi16(_mm_add_epi16(sum, load4(in)), load4(out));
+  }
+}
+
+static void
+vrowSSE2(const uint8_t *add, const uint8_t *sub, uint16_t *sums, uint8_t *dst, int n, uint16_t half, uint16_t mul) {
+  __m128i zero = _mm_setzero_si128()
+    , vhalf = _mm_set1_epi16(half)
+    , vmul = _mm_set1_epi16(mul);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i s0 = _mm_loadu_si128((const __m128i *)(sums + i))
+      , s1 = _mm_loadu_si128((const __m128i *)(sums + i + 8))
+      , q0 = _mm_mulhi_epu16(_mm_add_epi16(s0, vhalf), vmul)
+      , q1 = _mm_mulhi_epu16(_mm_add_epi16(s1, vhalf), vmul);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(q0, q1));
+
+    __m128i a = _mm_loadu_si128((const __m128i *)(add + i))
+      , b = _mm_loadu_si128((const __m128i *)(sub + i));
+    s0 = _mm_sub_epi16(_mm_add_epi16(s0, _mm_unpacklo_epi8(a, zero)), _mm_unpacklo_epi8(b, zero));
+    s1 = _mm_sub_epi16(_mm_add_epi16(s1, _mm_unpackhi_epi8(a, zero)), _mm_unpackhi_epi8(b, zero));
+    _mm_storeu_si128((__m128i *)(sums + i), s0);
+    _mm_storeu_si128((__m128i *)(sums + i + 8), s1);
+  }
+  vrowScalar(add + i, sub + i, sums + i, dst + i, n - i, half, mul);
+}
+
+static int
+supportedSSE2() {
+  return 1;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+/*
+ * Load the 4 channels at `p` into 16-bit lanes.
+ */
+
+static inline uint16x4_t
+load4(const uint8_t *p) {
+  uint32_t pixel;
+  memcpy(&pixel, p, 4);
+  return vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(pixel))));
+}
+
+/*
+ * Blur a single channel row, 8 pixels at a time.
+ */
+
+static void
+hrow1NEON(const uint8_t *pad, uint8_t *dst, int width, int r, uint16_t half, uint16_t mul) {
+  int d = 2 * r + 1
+    , sum = 0
+    , x = 0;
+  for (int i = 0; i < d; ++i) sum += pad[i];
+
+  const uint8_t *in = pad + d;
+  uint16x8_t zero = vdupq_n_u16(0)
+    , vhalf = vdupq_n_u16(half)
+    , base = vdupq_n_u16(sum);
+  uint16x4_t vmul = vdup_n_u16(mul);
+  for (; x + 8 <= width; x += 8) {
+    uint16x8_t v = vsubl_u8(vld1_u8(in + x), vld1_u8(pad + x));
+    v = vaddq_u16(v, vextq_u16(zero, v, 7));
+    v = vaddq_u16(v, vextq_u16(zero, v, 6));
+    v = vaddq_u16(v, vextq_u16(zero, v, 4));
+    uint16x8_t t = vaddq_u16(vaddq_u16(base, vextq_u16(zero, v, 7)), vhalf);
+    uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(t), vmul), 16)
+      , hi = vshrn_n_u32(vmull_u16(vget_high_u16(t), vmul), 16);
+    vst1_u8(dst + x, vqmovn_u16(vcombine_u16(lo, hi)));
+    base = vaddq_u16(base, vdupq_n_u16(vgetq_lane_u16(v, 7)));
+  }
+
+  sum = vgetq_lane_u16(base, 0);
+  for (; x < width; ++x) {
+    dst[x] = divide(sum, half, mul);
+    sum += in[x] - pad[x];
+  }
+}
+
+static void
+hrowNEON(const uint8_t *pad, uint8_t *dst, int width, int channels, int r, uint16_t half, uint16_t mul) {
+  if (1 == channels) return hrow1NEON(pad, dst, width, r, half, mul);
+  if (4 != channels) return hrowScalar(pad, dst, width, channels, r, half, mul);
+
+  uint16x4_t vhalf = vdup_n_u16(half)
+    , vmul = vdup_n_u16(mul)
+    , sum = vdup_n_u16(0);
+  int d = 2 * r + 1;
+  for (int i = 0; i < d; ++i) sum = vadd_u16(sum, load4(pad + i * 4));
+
+  const uint8_t *in = pad + d * 4
+    , *out = pad;
+  for (int x = 0; x < width; ++x, in += 4, out += 4, dst += 4) {
+    uint16x4_t q = vshrn_n_u32(vmull_u16(vadd_u16(sum, vhalf), vmul), 16);
+    uint32_t pixel = vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(q, q))), 0);
+    memcpy(dst, &pixel, 4);
+    sum = vsub_u16(vadd_u16(sum, load4(in)), load4(out));
+  }
+}
+
+static void
+vrowNEON(const uint8_t *add, const uint8_t *sub, uint16_t *sums, uint8_t *dst, int n, uint16_t half, uint16_t mul) {
+  uint16x8_t vhalf = vdupq_n_u16(half);
+  uint16x4_t vmul = vdup_n_u16(mul);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t s = vld1q_u16(sums + i)
+      , t = vaddq_u16(s, vhalf);
+    uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(t), vmul), 16)
+      , hi = vshrn_n_u32(vmull_u16(vget_high_u16(t), vmul), 16);
+    vst1_u8(dst + i, vqmovn_u16(vcombine_u16(lo, hi)));
+    s = vsubw_u8(vaddw_u8(s, vld1_u8(add + i)), vld1_u8(sub + i));
+    vst1q_u16(sums + i, s);
+  }
+  vrowScalar(add + i, sub + i, sums + i, dst + i, n - i, half, mul);
+}
+
+static int
+supportedNEON() {
+  return 1;
+}
+
+#endif /* HAVE_NEON_KERNELS */
+
+/*
+ * Kernels, preferred first.
+ */
+
+static kernel_t kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    { "sse2", hrowSSE2, vrowSSE2, supportedSSE2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "neon", hrowNEON, vrowNEON, supportedNEON },
+#endif
+    { "scalar", hrowScalar, vrowScalar, supportedScalar }
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * Selected kernel, the first supported on first use.
+ */
+
+static kernel_t *kernel;
+
+static kernel_t *
+selected() {
+  if (!kernel) {
+    unsigned i = 0;
+    while (!kernels[i].supported()) ++i;
+    kernel = &kernels[i];
+  }
+  return kernel;
+}
+
+/*
+ * Scratch bytes needed by blurBoxes().
+ */
+
+static size_t
+boxScratch(int width, int height, int channels, int r) {
+  size_t n = (size_t) width * channels;
+  return align16(n * height)
+    + align16((size_t) (width + 2 * r + 1) * channels)
+    + align16(n * 2)
+    + align16(n);
+}
+
+/*
+ * Blur `data` in place with CANVAS_BLUR_PASSES box passes
+ * of radius `r`, using `work` of boxScratch() bytes.
+ */
+
+static void
+blurBoxes(uint8_t *data, int width, int height, int stride, int channels, int r, uint8_t *work) {
+  kernel_t *k = selected();
+  size_t n = (size_t) width * channels
+    , padLen = (size_t) (width + 2 * r + 1) * channels;
+  uint8_t *tmp = work
+    , *pad = tmp + align16(n * height);
+  uint16_t *sums = (uint16_t *) (pad + align16(padLen));
+  uint8_t *zero = (uint8_t *) sums + align16(n * 2);
+
+  int d = 2 * r + 1;
+  uint16_t half = d / 2
+    , mul = (65536 + d - 1) / d;
+
+  memset(pad, 0, padLen);
+  memset(zero, 0, n);
+
+  for (int pass = 0; pass < CANVAS_BLUR_PASSES; ++pass) {
+    // Rows into tmp
+    for (int y = 0; y < height; ++y) {
+      memcpy(pad + r * channels, data + y * stride, n);
+      k->hrow(pad, tmp + y * n, width, channels, r, half, mul);
+    }
+
+    // Columns back into data
+    memset(sums, 0, n * 2);
+    for (int y = 0; y <= r && y < height; ++y) {
+      const uint8_t *row = tmp + y * n;
+      for (size_t i = 0; i < n; ++i) sums[i] += row[i];
+    }
+    for (int y = 0; y < height; ++y) {
+      const uint8_t *add = y + r + 1 < height ? tmp + (y + r + 1) * n : zero
+        , *sub = y - r >= 0 ? tmp + (y - r) * n : zero;
+      k->vrow(add, sub, sums, data + y * stride, n, half, mul);
+    }
+  }
+}
+
+/*
+ * Average `f` x `f` blocks of `src` into `dst`.
+ */
+
+static void
+downsample(
+    const uint8_t *src, int width, int height, int stride
+  , uint8_t *dst, int dw, int dh
+  , int channels, int f) {
+  for (int dy = 0; dy < dh; ++dy) {
+    int y1 = dy * f, y2 = y1 + f > height ? height : y1 + f;
+    for (int dx = 0; dx < dw; ++dx) {
+      int x1 = dx * f, x2 = x1 + f > width ? width : x1 + f
+        , count = (y2 - y1) * (x2 - x1);
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+      for (int y = y1; y < y2; ++y) {
+        const uint8_t *p = src + y * stride + x1 * channels;
+        for (int x = x1; x < x2; ++x)
+          for (int c = 0; c < channels; ++c) sum[c] += *p++;
+      }
+      for (int c = 0; c < channels; ++c)
+        *dst++ = (sum[c] + count / 2) / count;
+    }
+  }
+}
+
+/*
+ * Map the centre of pixel `i` at scale `f` to 24.8 fixed
+ * point coordinates in a `len` pixel source.
+ */
+
+static inline int
+sourcePos(int i, int f, int len) {
+  int pos = (2 * i + 1) * 128 / f - 128;
+  if (pos < 0) return 0;
+  if (pos > (len - 1) * 256) return (len - 1) * 256;
+  return pos;
+}
+
+/*
+ * Scale `src` up by `f` into `dst`, bilinearly, with the
+ * horizontal taps and weights for each column in `taps`.
+ */
+
+static void
+upsample(
+    const uint8_t *src, int sw, int sh
+  , uint8_t *dst, int width, int height, int stride
+  , int channels, int f, int *taps) {
+  for (int x = 0; x < width; ++x) {
+    int px = sourcePos(x, f, sw);
+    taps[x * 3] = (px >> 8) * channels;
+    taps[x * 3 + 1] = (px >> 8) + 1 < sw ? taps[x * 3] + channels : taps[x * 3];
+    taps[x * 3 + 2] = px & 0xff;
+  }
+
+  size_t sn = (size_t) sw * channels;
+  for (int y = 0; y < height; ++y) {
+    int py = sourcePos(y, f, sh)
+      , y0 = py >> 8
+      , y1 = y0 + 1 < sh ? y0 + 1 : y0
+      , wy = py & 0xff;
+    const uint8_t *r0 = src + y0 * sn
+      , *r1 = src + y1 * sn;
+    uint8_t *out = dst + y * stride;
+    const int *tap = taps;
+    for (int x = 0; x < width; ++x, tap += 3) {
+      int x0 = tap[0], x1 = tap[1], wx = tap[2];
+      for (int c = 0; c < channels; ++c) {
+        uint32_t top = r0[x0 + c] * (256 - wx) + r0[x1 + c] * wx
+          , bottom = r1[x0 + c] * (256 - wx) + r1[x1 + c] * wx;
+        *out++ = (top * (256 - wy) + bottom * wy + 0x8000) >> 16;
+      }
+    }
+  }
+}
+
+/*
+ * Grow `scratch` to at least `len` bytes.
+ */
+
+static int
+reserve(canvas_blur_scratch_t *scratch, size_t len) {
+  if (scratch->len >= len) return 1;
+  free(scratch->data);
+  scratch->data = (uint8_t *) malloc(len);
+  scratch->len = scratch->data ? len : 0;
+  return !!scratch->data;
+}
+
+/*
+ * Initialize empty scratch memory.
+ */
+
+void
+canvas_blur_scratch_init(canvas_blur_scratch_t *scratch) {
+  scratch->data = NULL;
+  scratch->len = 0;
+}
+
+/*
+ * Free scratch memory.
+ */
+
+void
+canvas_blur_scratch_free(canvas_blur_scratch_t *scratch) {
+  free(scratch->data);
+  canvas_blur_scratch_init(scratch);
+}
+
+/*
+ * Blur `data`, `channels` 1 (A8) or 4 (ARGB32) bytes per
+ * pixel, with CANVAS_BLUR_PASSES box passes of `radius`.
+ * Radii over CANVAS_BLUR_MAX_BOX are blurred at the largest
+ * power of two reduction keeping the box within it, then
+ * scaled back up bilinearly. Returns 0 when scratch memory
+ * could not be allocated, leaving `data` untouched.
+ */
+
+int
+canvas_blur(
+    uint8_t *data
+  , int width
+  , int height
+  , int stride
+  , int channels
+  , int radius
+  , canvas_blur_scratch_t *scratch) {
+  if (radius < 1 || width < 1 || height < 1) return 1;
+
+  int f = 1;
+  while (radius > CANVAS_BLUR_MAX_BOX * f) f *= 2;
+
+  if (1 == f) {
+    if (!reserve(scratch, boxScratch(width, height, channels, radius))) return 0;
+    blurBoxes(data, width, height, stride, channels, radius, scratch->data);
+    return 1;
+  }
+
+  int sw = (width + f - 1) / f
+    , sh = (height + f - 1) / f
+    , sr = (radius + f / 2) / f;
+  size_t smallLen = align16((size_t) sw * channels * sh)
+    , boxLen = boxScratch(sw, sh, channels, sr)
+    , tapsLen = (size_t) width * 3 * sizeof(int);
+  if (!reserve(scratch, smallLen + (boxLen > tapsLen ? boxLen : tapsLen))) return 0;
+
+  uint8_t *small = scratch->data;
+  downsample(data, width, height, stride, small, sw, sh, channels, f);
+  blurBoxes(small, sw, sh, sw * channels, channels, sr, small + smallLen);
+  upsample(small, sw, sh, data, width, height, stride, channels, f, (int *) (small + smallLen));
+  return 1;
+}
+
+/*
+ * Name of the kernel in use.
+ */
+
+const char *
+canvas_blur_kernel() {
+  return selected()->name;
+}
+
+/*
+ * Use the kernel `name` when supported, returning 0 otherwise.
+ */
+
+int
+canvas_blur_use(const char *name) {
+  selected();
+  for (unsigned i = 0; i < KERNEL_COUNT; ++i) {
+    if (0 == strcmp(name, kernels[i].name) && kernels[i].supported()) {
+      kernel = &kernels[i];
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+//
+// blur.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_BLUR_H__
+#define __NODE_BLUR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Box blur passes, three pass for a gaussian.
+ */
+
+#define CANVAS_BLUR_PASSES 3
+
+/*
+ * Largest box radius blurred at full resolution, larger
+ * radii are blurred on a downsampled copy. Keeps the
+ * window sums within 16 bits.
+ */
+
+#define CANVAS_BLUR_MAX_BOX 127
+
+/*
+ * Scratch memory, grown as needed and reused across blurs.
+ */
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} canvas_blur_scratch_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_blur_scratch_init(canvas_blur_scratch_t *scratch);
+
+void
+canvas_blur_scratch_free(canvas_blur_scratch_t *scratch);
+
+int
+canvas_blur(
+    uint8_t *data
+  , int width
+  , int height
+  , int stride
+  , int channels
+  , int radius
+  , canvas_blur_scratch_t *scratch);
+
+const char *
+canvas_blur_kernel();
+
+int
+canvas_blur_use(const char *name);
+
+#endif /* __NODE_BLUR_H__ */
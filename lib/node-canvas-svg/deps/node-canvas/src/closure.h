@@ -8,17 +8,88 @@
 #ifndef __NODE_CLOSURE_H__
 #define __NODE_CLOSURE_H__
 
+#include <pthread.h>
+#include "output.h"
+#include "encoder.h"
+#include "encodecache.h"
+
 /*
  * PNG stream closure.
  */
 
 typedef struct {
   Persistent<Function> pfn;
+  Persistent<Object> pbuf;
   Handle<Function> fn;
-  unsigned len;
-  uint8_t *data;
+  output_buffer_t output;
+  encode_options_t encode;
+  encode_cache_key_t key;
+  int hashed;
+  uint32_t generation;
   Canvas *canvas;
   cairo_status_t status;
 } closure_t;
 
+/*
+ * Encoded chunk produced on the thread pool.
+ */
+
+typedef struct chunk {
+  uint8_t *data;
+  unsigned len;
+  struct chunk *next;
+} chunk_t;
+
+/*
+ * Async encoder stream closure.
+ *
+ * Chunks are queued by the eio thread under `lock`
+ * and flushed to `pfn` on the loop via `async`.
+ */
+
+typedef struct {
+  Persistent<Function> pfn;
+  encode_options_t encode;
+  Canvas *canvas;
+  cairo_status_t status;
+  pthread_mutex_t lock;
+  ev_async async;
+  chunk_t *head;
+  chunk_t *tail;
+} stream_closure_t;
+
+/*
+ * renderBatch() job, one per canvas. Jobs are encoded
+ * independently on the thread pool and counted down on
+ * the loop, the last one completing the batch. Each has
+ * its own options and copy of a recording to replay.
+ */
+
+struct batch_closure;
+
+typedef struct {
+  Canvas *canvas;
+  cairo_surface_t *recording;
+  encode_options_t encode;
+  output_buffer_t output;
+  encode_cache_key_t key;
+  int hashed;
+  uint32_t generation;
+  int hit;
+  cairo_status_t status;
+  struct batch_closure *batch;
+} batch_job_t;
+
+/*
+ * renderBatch() closure.
+ */
+
+typedef struct batch_closure {
+  Persistent<Function> pfn;
+  encode_options_t encode;
+  batch_job_t *jobs;
+  int count;
+  int pending;
+} batch_closure_t;
+
 #endif /* __NODE_CLOSURE_H__ */
@@ -1,4 +1,3 @@
-
 //
 // color.cc
 //
@@ -7,6 +6,7 @@
 
 #include "color.h"
 #include <stdlib.h>
+#include <math.h>
 
 /*
  * Consume whitespace.
@@ -16,29 +16,27 @@
   while (' ' == *str) ++str;
 
 /*
- * Parse color channel value
+ * ASCII lowercase.
+ */
+
+#define LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + 32 : (c))
+
+/*
+ * Longest named color.
  */
 
-#define CHANNEL(NAME) \
-   if (*str >= '0' && *str <= '9') { \
-     do { \
-       NAME *= 10; \
-       NAME += *str++ - '0'; \
-     } while (*str >= '0' && *str <= '9'); \
-   } else { \
-     return 0; \
-   } \
-   while (' ' == *str || ',' == *str) str++;
+#define NAME_MAX_LEN 20
 
 /*
- * Named colors.
+ * Named colors, lowercase. Regenerate the hash tables
+ * below with util/colorhash.js after changing names.
  */
 
 static struct named_color {
   const char *name;
   uint32_t val;
 } named_colors[] = {
-    { "transparent", 0xffffff00}
+    { "transparent", 0xffffff00 }
   , { "aliceblue", 0xf0f8ffff }
   , { "antiquewhite", 0xfaebd7ff }
   , { "aqua", 0x00ffffff }
@@ -95,8 +93,8 @@ static struct named_color {
   , { "greenyellow", 0xadff2fff }
   , { "honeydew", 0xf0fff0ff }
   , { "hotpink", 0xff69b4ff }
-  , { "indianred ", 0xcd5c5cff }
-  , { "indigo ", 0x4b0082ff }
+  , { "indianred", 0xcd5c5cff }
+  , { "indigo", 0x4b0082ff }
   , { "ivory", 0xfffff0ff }
   , { "khaki", 0xf0e68cff }
   , { "lavender", 0xe6e6faff }
@@ -182,9 +180,45 @@ static struct named_color {
   , { "whitesmoke", 0xf5f5f5ff }
   , { "yellow", 0xffff00ff }
   , { "yellowgreen", 0x9acd32ff }
-  , { NULL, NULL }
 };
 
+/*
+ * Generated by util/colorhash.js for 144 names.
+ */
+
+static const uint8_t color_disp[64] = {
+    0, 3, 0, 0, 0, 6, 1, 0, 2, 2, 6, 0, 0, 0, 0, 0
+  , 0, 1, 3, 2, 4, 1, 1, 0, 2, 3, 0, 0, 1, 0, 0, 0
+  , 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0
+  , 1, 3, 0, 0, 0, 2, 1, 1, 0, 0, 1, 0, 5, 0, 1, 1
+};
+
+static const uint8_t color_slots[256] = {
+    91, 22, 105, 143, 255, 126, 117, 255, 88, 255, 95, 32, 255, 78, 255, 11
+  , 137, 93, 14, 255, 29, 255, 255, 255, 80, 255, 102, 139, 255, 65, 23, 255
+  , 33, 99, 255, 255, 121, 255, 255, 58, 96, 70, 48, 255, 19, 255, 255, 63
+  , 25, 255, 255, 255, 53, 255, 136, 101, 34, 118, 255, 255, 255, 255, 255, 255
+  , 255, 37, 255, 255, 138, 255, 130, 255, 107, 84, 255, 140, 255, 108, 114, 255
+  , 135, 255, 255, 255, 90, 74, 255, 255, 49, 142, 255, 27, 6, 28, 255, 255
+  , 66, 9, 86, 77, 255, 255, 42, 255, 113, 129, 112, 3, 16, 255, 72, 255
+  , 255, 132, 20, 68, 255, 255, 255, 255, 97, 255, 109, 255, 104, 67, 255, 38
+  , 131, 255, 64, 41, 255, 103, 124, 255, 4, 30, 57, 255, 255, 76, 73, 255
+  , 46, 62, 255, 50, 98, 141, 255, 255, 8, 255, 255, 134, 75, 133, 15, 255
+  , 94, 110, 255, 255, 255, 47, 255, 255, 115, 17, 10, 59, 255, 69, 83, 255
+  , 44, 120, 255, 255, 122, 255, 51, 45, 255, 127, 43, 255, 255, 255, 255, 54
+  , 1, 24, 89, 60, 255, 35, 255, 21, 255, 2, 92, 255, 26, 87, 81, 255
+  , 125, 106, 255, 5, 255, 255, 255, 255, 255, 52, 111, 7, 255, 71, 255, 116
+  , 123, 255, 55, 85, 40, 13, 255, 0, 39, 128, 79, 31, 12, 82, 61, 255
+  , 18, 255, 255, 255, 36, 255, 255, 255, 56, 255, 255, 255, 100, 255, 119, 255
+};
+
+/*
+ * Slot of the name hashing to `h1`, `h2`, see util/colorhash.js.
+ */
+
+#define COLOR_SLOT(h1, h2) \
+  (((h2) + color_disp[(h1) & 63] * 0x9e3779b9u) * 0x85ebca6bu >> 24)
+
 /*
  * Hex digit int val.
  */
@@ -269,143 +303,235 @@ rgba_from_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
 }
 
 /*
- * Return rgba from (r,g,b).
+ * Return rgba from:
+ *
+ *  - "RGB"
+ *  - "RGBA"
+ *  - "RRGGBB"
+ *  - "RRGGBBAA"
+ *
  */
 
 static int32_t
-rgba_from_rgb(uint8_t r, uint8_t g, uint8_t b) {
-  return rgba_from_rgba(r, g, b, 255);
+rgba_from_hex_string(const char *str, short *ok) {
+  const char *hex = str;
+  while (*str && ' ' != *str) ++str;
+  size_t len = str - hex;
+  WHITESPACE;
+  if (*str) return 0;
+
+  *ok = 1;
+  switch (len) {
+    case 3:
+    case 4:
+      return rgba_from_rgba(
+          h(hex[0]) * 17
+        , h(hex[1]) * 17
+        , h(hex[2]) * 17
+        , 4 == len ? h(hex[3]) * 17 : 255);
+    case 6:
+    case 8:
+      return rgba_from_rgba(
+          (h(hex[0]) << 4) + h(hex[1])
+        , (h(hex[2]) << 4) + h(hex[3])
+        , (h(hex[4]) << 4) + h(hex[5])
+        , 8 == len ? (h(hex[6]) << 4) + h(hex[7]) : 255);
+  }
+  return *ok = 0;
 }
 
 /*
- * Return rgb from "#RRGGBB".
+ * Parse a decimal number at `str` into `val` in thousandths,
+ * returning the position past it or NULL when there is none.
+ * Magnitudes saturate at a million.
  */
 
-static int32_t
-rgba_from_hex6_string(const char *str) {
-  return rgba_from_rgb(
-      (h(str[0]) << 4) + h(str[1])
-    , (h(str[2]) << 4) + h(str[3])
-    , (h(str[4]) << 4) + h(str[5])
-    );
+static const char *
+parse_number(const char *str, int *val) {
+  const char *start;
+  int sign = 1, n = 0, scale = 1000;
+  if ('-' == *str) sign = -1, ++str;
+  else if ('+' == *str) ++str;
+
+  start = str;
+  while (*str >= '0' && *str <= '9') {
+    if (n < 1000000) n = n * 10 + (*str - '0');
+    ++str;
+  }
+  int digits = str - start;
+  if (n > 1000000) n = 1000000;
+  n *= 1000;
+
+  if ('.' == *str) {
+    start = ++str;
+    while (*str >= '0' && *str <= '9') {
+      if (scale > 1) scale /= 10, n += (*str - '0') * scale;
+      ++str;
+    }
+    digits += str - start;
+  }
+
+  *val = sign * n;
+  return digits ? str : NULL;
 }
 
 /*
- * Return rgb from "#RGB"
+ * Return a color channel from a number or percentage
+ * in thousandths, rounded.
  */
 
-static int32_t
-rgba_from_hex3_string(const char *str) {
-  return rgba_from_rgb(
-      (h(str[0]) << 4) + h(str[0])
-    , (h(str[1]) << 4) + h(str[1])
-    , (h(str[2]) << 4) + h(str[2])
-    );
+static uint8_t
+channel(int val, int percent) {
+  if (val <= 0) return 0;
+  if (percent) return val >= 100000 ? 255 : (val * 255 + 50000) / 100000;
+  return val >= 255000 ? 255 : (val + 500) / 1000;
 }
 
 /*
- * Return rgb from "rgb()"
+ * Return the alpha channel from a number or percentage
+ * in thousandths, truncated.
  */
 
-static int32_t
-rgba_from_rgb_string(const char *str, short *ok) {
-  if (str == strstr(str, "rgb(")) {
-    str += 4;
-    WHITESPACE;
-    uint8_t r = 0, g = 0, b = 0;
-    CHANNEL(r);
-    CHANNEL(g);
-    CHANNEL(b);
-    return *ok = 1, rgba_from_rgb(r, g, b);
-  }
-  return *ok = 0;
+static uint8_t
+alpha(int val, int percent) {
+  int max = percent ? 100000 : 1000;
+  if (val <= 0) return 0;
+  if (val >= max) return 255;
+  return val * 255 / max;
 }
 
 /*
- * Return rgb from "rgba()"
+ * Return the channel at hue `t` in turns for the given
+ * hsl bounds.
  */
 
-static int32_t
-rgba_from_rgba_string(const char *str, short *ok) {
-  if (str == strstr(str, "rgba(")) {
-    str += 5;
-    WHITESPACE;
-    uint8_t r = 0, g = 0, b = 0;
-    float a = 0;
-    CHANNEL(r);
-    CHANNEL(g);
-    CHANNEL(b);
-    // TODO: less strict
-    if ('1' == *str) {
-      a = 1;
-    } else {
-      if ('0' == *str) a = 0, ++str;
-      if ('.' == *str) {
-        ++str;
-        float n = .1;
-        while (*str >= '0' && *str <= '9') {
-          a += (*str++ - '0') * n;
-          n *= .1;
-        }
-      }
-    }
-    return *ok = 1, rgba_from_rgba(r, g, b, (int) (a * 255));
-  }
-  return *ok = 0;
+static double
+hue(double m1, double m2, double t) {
+  if (t < 0) t += 1;
+  if (t > 1) t -= 1;
+  if (t * 6 < 1) return m1 + (m2 - m1) * t * 6;
+  if (t * 2 < 1) return m2;
+  if (t * 3 < 2) return m1 + (m2 - m1) * (2. / 3 - t) * 6;
+  return m1;
 }
 
 /*
- * Return rgb from:
- *  
- *  - "#RGB"
- *  - "#RRGGBB"
+ * Return rgba from the arguments of:
  *
+ *  - "rgb(r, g, b)"
+ *  - "rgba(r, g, b, a)"
+ *  - "hsl(h, s%, l%)"
+ *  - "hsla(h, s%, l%, a)"
+ *
+ * Channels may be percentages, alpha is optional in
+ * either form and may follow a "/".
  */
 
 static int32_t
-rgba_from_hex_string(const char *str, short *ok) {
-  size_t len = strlen(str);
-  *ok = 1;
-  if (6 == len) return rgba_from_hex6_string(str);
-  if (3 == len) return rgba_from_hex3_string(str);
-  return *ok = 0;
-}
+rgba_from_function(const char *name, size_t len, const char *str, short *ok) {
+  int hsl;
+  if ((3 == len || (4 == len && 'a' == LOWER(name[3])))
+    && 'r' == LOWER(name[0]) && 'g' == LOWER(name[1]) && 'b' == LOWER(name[2])) {
+    hsl = 0;
+  } else if ((3 == len || (4 == len && 'a' == LOWER(name[3])))
+    && 'h' == LOWER(name[0]) && 's' == LOWER(name[1]) && 'l' == LOWER(name[2])) {
+    hsl = 1;
+  } else {
+    return 0;
+  }
 
-/*
- * Return named color value.
- */
+  int args[4], percent[4], n = 0;
+  WHITESPACE;
+  while (')' != *str) {
+    if (4 == n || !(str = parse_number(str, &args[n]))) return 0;
+    percent[n] = '%' == *str;
+    if (percent[n]) {
+      ++str;
+    } else if (hsl && !n && 'd' == str[0] && 'e' == str[1] && 'g' == str[2]) {
+      str += 3;
+    }
+    ++n;
+    WHITESPACE;
+    if (',' == *str || '/' == *str) ++str;
+    WHITESPACE;
+  }
+  ++str;
+  WHITESPACE;
+  if (*str || n < 3) return 0;
 
-static int32_t
-rgba_from_name_string(const char *str, short *ok) {
-  int i = 0;
-  struct named_color color;
-  while ((color = named_colors[i++]).name) {
-    if (*str == *color.name && 0 == strcmp(str, color.name))
-      return *ok = 1, color.val;
+  uint8_t a = 4 == n ? alpha(args[3], percent[3]) : 255;
+  *ok = 1;
+  if (!hsl) {
+    return rgba_from_rgba(
+        channel(args[0], percent[0])
+      , channel(args[1], percent[1])
+      , channel(args[2], percent[2])
+      , a);
   }
-  return *ok = 0;
+
+  double t = fmod(args[0] / 1000., 360) / 360
+    , s = fmin(fmax(args[1] / 1000., 0), 100) / 100
+    , l = fmin(fmax(args[2] / 1000., 0), 100) / 100
+    , m2 = l <= .5 ? l * (s + 1) : l + s - l * s
+    , m1 = l * 2 - m2;
+  if (t < 0) t += 1;
+  return rgba_from_rgba(
+      (uint8_t) (hue(m1, m2, t + 1. / 3) * 255 + .5)
+    , (uint8_t) (hue(m1, m2, t) * 255 + .5)
+    , (uint8_t) (hue(m1, m2, t - 1. / 3) * 255 + .5)
+    , a);
 }
 
 /*
  * Return rgb from:
- *  
+ *
  *  - #RGB
+ *  - #RGBA
  *  - #RRGGBB
+ *  - #RRGGBBAA
  *  - rgb(r,g,b)
  *  - rgba(r,g,b,a)
+ *  - hsl(h,s,l)
+ *  - hsla(h,s,l,a)
  *  - name
  *
+ * in a single pass. Names and function names are hashed
+ * as they are scanned, names are then looked up in the
+ * perfect hash tables and compared once.
  */
 
 int32_t
 rgba_from_string(const char *str, short *ok) {
-  if ('#' == str[0]) 
+  *ok = 0;
+  WHITESPACE;
+  if ('#' == *str)
     return rgba_from_hex_string(++str, ok);
-  if (str == strstr(str, "rgba"))
-    return rgba_from_rgba_string(str, ok);
-  if (str == strstr(str, "rgb"))
-    return rgba_from_rgb_string(str, ok);
-  return rgba_from_name_string(str, ok);
+
+  const char *name = str;
+  uint32_t h1 = 2166136261u, h2 = 0;
+  while (*str && '(' != *str && ' ' != *str) {
+    char c = LOWER(*str);
+    if (c < 'a' || c > 'z') return 0;
+    h1 = (h1 ^ c) * 16777619u;
+    h2 = h2 * 31 + c;
+    ++str;
+  }
+  size_t len = str - name;
+
+  if ('(' == *str)
+    return rgba_from_function(name, len, ++str, ok);
+
+  WHITESPACE;
+  if (*str || !len || len > NAME_MAX_LEN) return 0;
+
+  uint8_t i = color_slots[COLOR_SLOT(h1, h2)];
+  if (255 == i) return 0;
+  const char *match = named_colors[i].name;
+  for (size_t j = 0; j < len; ++j) {
+    if (LOWER(name[j]) != match[j]) return 0;
+  }
+  if (match[len]) return 0;
+  return *ok = 1, named_colors[i].val;
 }
 
 /*
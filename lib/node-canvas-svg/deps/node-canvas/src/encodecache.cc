@@ -0,0 +1,153 @@
+//
+// encodecache.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "encodecache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Cache entry, most recently used first.
+ */
+
+typedef struct entry {
+  encode_cache_key_t key;
+  uint8_t *data;
+  unsigned len;
+  struct entry *prev;
+  struct entry *next;
+} entry_t;
+
+/*
+ * LRU list and totals. Only accessed from the
+ * loop thread, so no locking is required.
+ */
+
+static entry_t *head = NULL;
+static entry_t *tail = NULL;
+static unsigned entries = 0;
+static unsigned long bytes = 0;
+
+/*
+ * Check if keys `a` and `b` are equal.
+ */
+
+static int
+equal(encode_cache_key_t *a, encode_cache_key_t *b) {
+  return a->hash == b->hash
+    && a->width == b->width
+    && a->height == b->height
+    && encode_options_equal(&a->opts, &b->opts);
+}
+
+/*
+ * Detach `e`.
+ */
+
+static void
+detach(entry_t *e) {
+  if (e->prev) e->prev->next = e->next;
+  else head = e->next;
+  if (e->next) e->next->prev = e->prev;
+  else tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+/*
+ * Attach `e` as most recently used.
+ */
+
+static void
+attach(entry_t *e) {
+  e->prev = NULL;
+  e->next = head;
+  if (head) head->prev = e;
+  head = e;
+  if (!tail) tail = e;
+}
+
+/*
+ * Detach and free `e`.
+ */
+
+static void
+evict(entry_t *e) {
+  detach(e);
+  --entries;
+  bytes -= e->len;
+  free(e->data);
+  free(e);
+}
+
+/*
+ * Find the entry for `key`.
+ */
+
+static entry_t *
+find(encode_cache_key_t *key) {
+  for (entry_t *e = head; e; e = e->next)
+    if (equal(&e->key, key)) return e;
+  return NULL;
+}
+
+/*
+ * Look up encoded output for `key`. On a hit `data` and `len`
+ * are set, the data remaining valid until the next put or clear.
+ */
+
+int
+encode_cache_get(encode_cache_key_t *key, const uint8_t **data, unsigned *len) {
+  entry_t *e = find(key);
+  if (!e) return 0;
+  detach(e);
+  attach(e);
+  *data = e->data;
+  *len = e->len;
+  return 1;
+}
+
+/*
+ * Store a copy of the encoded output for `key`, evicting least
+ * recently used entries. Outputs over a quarter of the budget
+ * are not retained.
+ */
+
+void
+encode_cache_put(encode_cache_key_t *key, const uint8_t *data, size_t len) {
+  entry_t *e;
+  if (len > ENCODE_CACHE_MAX_BYTES / 4) return;
+
+  if ((e = find(key))) {
+    detach(e);
+    attach(e);
+    return;
+  }
+
+  if (!(e = (entry_t *) malloc(sizeof(entry_t)))) return;
+  if (!(e->data = (uint8_t *) malloc(len ? len : 1))) {
+    free(e);
+    return;
+  }
+
+  memcpy(e->data, data, len);
+  e->key = *key;
+  e->len = len;
+
+  while (tail && (entries >= ENCODE_CACHE_MAX_ENTRIES
+    || bytes + len > ENCODE_CACHE_MAX_BYTES)) evict(tail);
+
+  attach(e);
+  ++entries;
+  bytes += len;
+}
+
+/*
+ * Free all entries.
+ */
+
+void
+encode_cache_clear() {
+  while (tail) evict(tail);
+}
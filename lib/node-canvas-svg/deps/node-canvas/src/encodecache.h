@@ -0,0 +1,55 @@
+//
+// encodecache.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_ENCODE_CACHE_H__
+#define __NODE_ENCODE_CACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "encoder.h"
+
+/*
+ * Max bytes of encoded output retained.
+ */
+
+#ifndef ENCODE_CACHE_MAX_BYTES
+#define ENCODE_CACHE_MAX_BYTES (16 * 1024 * 1024)
+#endif
+
+/*
+ * Max entries retained.
+ */
+
+#ifndef ENCODE_CACHE_MAX_ENTRIES
+#define ENCODE_CACHE_MAX_ENTRIES 32
+#endif
+
+/*
+ * Cache key, the surface content hash and
+ * dimensions plus the encoder options.
+ */
+
+typedef struct {
+  uint64_t hash;
+  int width;
+  int height;
+  encode_options_t opts;
+} encode_cache_key_t;
+
+/*
+ * Prototypes.
+ */
+
+int
+encode_cache_get(encode_cache_key_t *key, const uint8_t **data, unsigned *len);
+
+void
+encode_cache_put(encode_cache_key_t *key, const uint8_t *data, size_t len);
+
+void
+encode_cache_clear();
+
+#endif /* __NODE_ENCODE_CACHE_H__ */
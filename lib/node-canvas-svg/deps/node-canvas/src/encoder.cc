@@ -0,0 +1,70 @@
+//
+// encoder.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "encoder.h"
+
+/*
+ * Initialize default options for `type`.
+ */
+
+void
+encode_options_init(encode_options_t *opts, encode_type_t type) {
+  opts->type = type;
+  canvas_png_options_init(&opts->png);
+  canvas_jpeg_options_init(&opts->jpeg);
+  canvas_raw_options_init(&opts->raw);
+}
+
+/*
+ * Check if `a` and `b` produce the same output. Only the
+ * options of the selected encoder are compared.
+ */
+
+int
+encode_options_equal(encode_options_t *a, encode_options_t *b) {
+  if (a->type != b->type) return 0;
+  switch (a->type) {
+    case ENCODE_PNG:
+      return a->png.compressionLevel == b->png.compressionLevel
+        && a->png.filters == b->png.filters
+        && a->png.palette == b->png.palette
+        && a->png.dither == b->png.dither
+        && a->png.strips == b->png.strips
+        && a->png.backend == b->png.backend;
+    case ENCODE_JPEG:
+      return a->jpeg.quality == b->jpeg.quality
+        && a->jpeg.progressive == b->jpeg.progressive;
+    case ENCODE_RAW:
+      return a->raw.layout == b->raw.layout;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Encode `surface` with the encoder selected by `opts->type`,
+ * passing the bytes to `write`.
+ */
+
+cairo_status_t
+canvas_encode(
+    cairo_surface_t *surface
+  , encode_options_t *opts
+  , cairo_write_func_t write
+  , void *closure) {
+  switch (opts->type) {
+    case ENCODE_PNG:
+      return canvas_png_write(surface, &opts->png, write, closure);
+#ifdef HAVE_JPEG
+    case ENCODE_JPEG:
+      return canvas_jpeg_write(surface, &opts->jpeg, write, closure);
+#endif
+    case ENCODE_RAW:
+      return canvas_raw_write(surface, &opts->raw, write, closure);
+    default:
+      return CAIRO_STATUS_INVALID_FORMAT;
+  }
+}
@@ -0,0 +1,53 @@
+//
+// encoder.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_ENCODER_H__
+#define __NODE_ENCODER_H__
+
+#include "pngencoder.h"
+#include "jpegencoder.h"
+#include "rawencoder.h"
+
+/*
+ * Output formats.
+ */
+
+typedef enum {
+    ENCODE_PNG
+  , ENCODE_JPEG
+  , ENCODE_RAW
+  , ENCODE_TYPES
+} encode_type_t;
+
+/*
+ * Options for any encoder, `type` selects which apply.
+ */
+
+typedef struct {
+  encode_type_t type;
+  canvas_png_options_t png;
+  canvas_jpeg_options_t jpeg;
+  canvas_raw_options_t raw;
+} encode_options_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+encode_options_init(encode_options_t *opts, encode_type_t type);
+
+int
+encode_options_equal(encode_options_t *a, encode_options_t *b);
+
+cairo_status_t
+canvas_encode(
+    cairo_surface_t *surface
+  , encode_options_t *opts
+  , cairo_write_func_t write
+  , void *closure);
+
+#endif /* __NODE_ENCODER_H__ */
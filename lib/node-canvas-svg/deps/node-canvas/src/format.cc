@@ -0,0 +1,135 @@
+//
+// format.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "format.h"
+#include <string.h>
+
+/*
+ * Surface formats by name.
+ */
+
+static struct {
+  const char *name;
+  cairo_format_t format;
+} formats[] = {
+    { "argb32", CAIRO_FORMAT_ARGB32 }
+  , { "rgb24", CAIRO_FORMAT_RGB24 }
+  , { "a8", CAIRO_FORMAT_A8 }
+  , { "rgb16_565", CAIRO_FORMAT_RGB16_565 }
+};
+
+#define FORMAT_COUNT (sizeof(formats) / sizeof(formats[0]))
+
+/*
+ * Parse format `name`, returning 0 when unsupported.
+ */
+
+int
+canvas_format_parse(const char *name, cairo_format_t *format) {
+  for (unsigned i = 0; i < FORMAT_COUNT; ++i) {
+    if (0 == strcmp(name, formats[i].name)) {
+      *format = formats[i].format;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Name of `format`.
+ */
+
+const char *
+canvas_format_name(cairo_format_t format) {
+  for (unsigned i = 0; i < FORMAT_COUNT; ++i) {
+    if (format == formats[i].format) return formats[i].name;
+  }
+  return "unknown";
+}
+
+/*
+ * Bytes per pixel of `format`.
+ */
+
+int
+canvas_format_bpp(cairo_format_t format) {
+  switch (format) {
+    case CAIRO_FORMAT_A8: return 1;
+    case CAIRO_FORMAT_RGB16_565: return 2;
+    default: return 4;
+  }
+}
+
+/*
+ * Convert a row of `width` pixels in `format` to premultiplied
+ * ARGB32. RGB24 and RGB16_565 are opaque, A8 is black with
+ * the given alpha.
+ */
+
+void
+canvas_format_to_argb32(cairo_format_t format, const uint8_t *src, uint32_t *dst, int width) {
+  switch (format) {
+    case CAIRO_FORMAT_RGB24: {
+      const uint32_t *px = (const uint32_t *) src;
+      for (int x = 0; x < width; ++x)
+        dst[x] = 0xff000000 | px[x];
+      break;
+    }
+    case CAIRO_FORMAT_A8:
+      for (int x = 0; x < width; ++x)
+        dst[x] = (uint32_t) src[x] << 24;
+      break;
+    case CAIRO_FORMAT_RGB16_565: {
+      const uint16_t *px = (const uint16_t *) src;
+      for (int x = 0; x < width; ++x) {
+        uint32_t r = (px[x] >> 11) & 0x1f
+          , g = (px[x] >> 5) & 0x3f
+          , b = px[x] & 0x1f;
+        dst[x] = 0xff000000
+          | (r << 3 | r >> 2) << 16
+          | (g << 2 | g >> 4) << 8
+          | (b << 3 | b >> 2);
+      }
+      break;
+    }
+    default:
+      memcpy(dst, src, width * 4);
+  }
+}
+
+/*
+ * Convert a row of `width` premultiplied ARGB32 pixels to
+ * `format`. Opaque formats keep the colour composited over
+ * black, A8 keeps the alpha.
+ */
+
+void
+canvas_format_from_argb32(cairo_format_t format, const uint32_t *src, uint8_t *dst, int width) {
+  switch (format) {
+    case CAIRO_FORMAT_RGB24: {
+      uint32_t *px = (uint32_t *) dst;
+      for (int x = 0; x < width; ++x)
+        px[x] = src[x] & 0xffffff;
+      break;
+    }
+    case CAIRO_FORMAT_A8:
+      for (int x = 0; x < width; ++x)
+        dst[x] = src[x] >> 24;
+      break;
+    case CAIRO_FORMAT_RGB16_565: {
+      uint16_t *px = (uint16_t *) dst;
+      for (int x = 0; x < width; ++x) {
+        uint32_t p = src[x];
+        px[x] = ((p >> 8) & 0xf800)
+          | ((p >> 5) & 0x07e0)
+          | ((p >> 3) & 0x001f);
+      }
+      break;
+    }
+    default:
+      memcpy(dst, src, width * 4);
+  }
+}
@@ -0,0 +1,32 @@
+//
+// format.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_FORMAT_H__
+#define __NODE_FORMAT_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Prototypes.
+ */
+
+int
+canvas_format_parse(const char *name, cairo_format_t *format);
+
+const char *
+canvas_format_name(cairo_format_t format);
+
+int
+canvas_format_bpp(cairo_format_t format);
+
+void
+canvas_format_to_argb32(cairo_format_t format, const uint8_t *src, uint32_t *dst, int width);
+
+void
+canvas_format_from_argb32(cairo_format_t format, const uint32_t *src, uint8_t *dst, int width);
+
+#endif /* __NODE_FORMAT_H__ */
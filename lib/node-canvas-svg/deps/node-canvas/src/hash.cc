@@ -0,0 +1,129 @@
+//
+// hash.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "hash.h"
+#include <string.h>
+
+/*
+ * XXH64 primes.
+ */
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+/*
+ * Rotate `n` left by `r` bits.
+ */
+
+static inline uint64_t
+rotl(uint64_t n, int r) {
+  return (n << r) | (n >> (64 - r));
+}
+
+/*
+ * Unaligned little-endian loads.
+ */
+
+static inline uint64_t
+read64(const uint8_t *p) {
+  uint64_t n;
+  memcpy(&n, p, 8);
+  return n;
+}
+
+static inline uint32_t
+read32(const uint8_t *p) {
+  uint32_t n;
+  memcpy(&n, p, 4);
+  return n;
+}
+
+/*
+ * Mix a lane.
+ */
+
+static inline uint64_t
+mix(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  acc = rotl(acc, 31);
+  return acc * PRIME1;
+}
+
+/*
+ * Merge a lane into the hash.
+ */
+
+static inline uint64_t
+merge(uint64_t hash, uint64_t lane) {
+  hash ^= mix(0, lane);
+  return hash * PRIME1 + PRIME4;
+}
+
+/*
+ * XXH64 of `len` bytes at `data`.
+ *
+ * The four independent lanes keep several multiplies in
+ * flight per cycle, hashing surface data at memory speed.
+ */
+
+uint64_t
+canvas_hash(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *p = (const uint8_t *) data
+    , *end = p + len;
+  uint64_t hash;
+
+  if (len >= 32) {
+    const uint8_t *limit = end - 32;
+    uint64_t v1 = seed + PRIME1 + PRIME2
+      , v2 = seed + PRIME2
+      , v3 = seed
+      , v4 = seed - PRIME1;
+
+    do {
+      v1 = mix(v1, read64(p));
+      v2 = mix(v2, read64(p + 8));
+      v3 = mix(v3, read64(p + 16));
+      v4 = mix(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    hash = merge(hash, v1);
+    hash = merge(hash, v2);
+    hash = merge(hash, v3);
+    hash = merge(hash, v4);
+  } else {
+    hash = seed + PRIME5;
+  }
+
+  hash += len;
+
+  for (; p + 8 <= end; p += 8) {
+    hash ^= mix(0, read64(p));
+    hash = rotl(hash, 27) * PRIME1 + PRIME4;
+  }
+
+  if (p + 4 <= end) {
+    hash ^= (uint64_t) read32(p) * PRIME1;
+    hash = rotl(hash, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+
+  for (; p < end; ++p) {
+    hash ^= *p * PRIME5;
+    hash = rotl(hash, 11) * PRIME1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
@@ -0,0 +1,20 @@
+//
+// hash.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_HASH_H__
+#define __NODE_HASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Prototypes.
+ */
+
+uint64_t
+canvas_hash(const void *data, size_t len, uint64_t seed);
+
+#endif /* __NODE_HASH_H__ */
@@ -0,0 +1,191 @@
+//
+// jpegencoder.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "jpegencoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+/*
+ * Initialize default options.
+ */
+
+void
+canvas_jpeg_options_init(canvas_jpeg_options_t *opts) {
+  opts->quality = 75;
+  opts->progressive = 0;
+}
+
+#ifdef HAVE_JPEG
+
+/*
+ * Size of the buffer handed to libjpeg.
+ */
+
+#define JPEG_BUFFER_SIZE 4096
+
+/*
+ * Destination manager passing output to a cairo_write_func_t.
+ */
+
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  cairo_write_func_t write;
+  void *closure;
+  cairo_status_t status;
+  JOCTET buf[JPEG_BUFFER_SIZE];
+} dest_mgr_t;
+
+/*
+ * Error manager, longjmp()s instead of exit()ing.
+ */
+
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf jmp;
+} error_mgr_t;
+
+static void
+errorExit(j_common_ptr info) {
+  longjmp(((error_mgr_t *) info->err)->jmp, 1);
+}
+
+static void
+initDestination(j_compress_ptr info) {
+  dest_mgr_t *dest = (dest_mgr_t *) info->dest;
+  dest->pub.next_output_byte = dest->buf;
+  dest->pub.free_in_buffer = JPEG_BUFFER_SIZE;
+}
+
+static boolean
+emptyOutputBuffer(j_compress_ptr info) {
+  dest_mgr_t *dest = (dest_mgr_t *) info->dest;
+  if ((dest->status = dest->write(dest->closure, dest->buf, JPEG_BUFFER_SIZE)))
+    errorExit((j_common_ptr) info);
+  dest->pub.next_output_byte = dest->buf;
+  dest->pub.free_in_buffer = JPEG_BUFFER_SIZE;
+  return TRUE;
+}
+
+static void
+termDestination(j_compress_ptr info) {
+  dest_mgr_t *dest = (dest_mgr_t *) info->dest;
+  unsigned len = JPEG_BUFFER_SIZE - dest->pub.free_in_buffer;
+  if (len && (dest->status = dest->write(dest->closure, dest->buf, len)))
+    errorExit((j_common_ptr) info);
+}
+
+/*
+ * Encode `surface` as JPEG, passing the bytes to `write`.
+ * Alpha is dropped, leaving the premultiplied colour composited
+ * over black. A8 surfaces are written as grayscale of their
+ * alpha, as with PNG.
+ */
+
+cairo_status_t
+canvas_jpeg_write(
+    cairo_surface_t *surface
+  , canvas_jpeg_options_t *opts
+  , cairo_write_func_t write
+  , void *closure) {
+
+  cairo_format_t format = cairo_image_surface_get_format(surface);
+  switch (format) {
+    case CAIRO_FORMAT_ARGB32:
+    case CAIRO_FORMAT_RGB24:
+    case CAIRO_FORMAT_A8:
+    case CAIRO_FORMAT_RGB16_565:
+      break;
+    default:
+      return CAIRO_STATUS_INVALID_FORMAT;
+  }
+  int gray = CAIRO_FORMAT_A8 == format;
+
+  cairo_surface_flush(surface);
+  uint8_t *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface)
+    , width = cairo_image_surface_get_width(surface)
+    , height = cairo_image_surface_get_height(surface);
+
+  if (!width || !height) return CAIRO_STATUS_INVALID_SIZE;
+
+  uint8_t *row = (uint8_t *) malloc(width * 3);
+  if (!row) return CAIRO_STATUS_NO_MEMORY;
+
+  dest_mgr_t dest;
+  dest.pub.init_destination = initDestination;
+  dest.pub.empty_output_buffer = emptyOutputBuffer;
+  dest.pub.term_destination = termDestination;
+  dest.write = write;
+  dest.closure = closure;
+  dest.status = CAIRO_STATUS_SUCCESS;
+
+  struct jpeg_compress_struct info;
+  error_mgr_t err;
+  info.err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = errorExit;
+
+  if (setjmp(err.jmp)) {
+    jpeg_destroy_compress(&info);
+    free(row);
+    return dest.status
+      ? dest.status
+      : CAIRO_STATUS_WRITE_ERROR;
+  }
+
+  jpeg_create_compress(&info);
+  info.dest = &dest.pub;
+  info.image_width = width;
+  info.image_height = height;
+  info.input_components = gray ? 1 : 3;
+  info.in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&info);
+  jpeg_set_quality(&info, opts->quality, TRUE);
+  if (opts->progressive) jpeg_simple_progression(&info);
+  jpeg_start_compress(&info, TRUE);
+
+  // ARGB / RGB16_565 -> RGB, A8 rows are written as-is
+  JSAMPROW rows[1] = { row };
+  while (info.next_scanline < info.image_height) {
+    uint8_t *line = data + stride * info.next_scanline
+      , *dst = row;
+    if (gray) {
+      rows[0] = line;
+    } else if (CAIRO_FORMAT_RGB16_565 == format) {
+      uint16_t *src = (uint16_t *) line;
+      for (int x = 0; x < width; ++x) {
+        uint16_t pixel = src[x];
+        uint8_t r = (pixel >> 11) & 0x1f
+          , g = (pixel >> 5) & 0x3f
+          , b = pixel & 0x1f;
+        *dst++ = r << 3 | r >> 2;
+        *dst++ = g << 2 | g >> 4;
+        *dst++ = b << 3 | b >> 2;
+      }
+    } else {
+      uint32_t *src = (uint32_t *) line;
+      for (int x = 0; x < width; ++x) {
+        uint32_t pixel = src[x];
+        *dst++ = pixel >> 16;
+        *dst++ = pixel >> 8;
+        *dst++ = pixel;
+      }
+    }
+    jpeg_write_scanlines(&info, rows, 1);
+  }
+
+  jpeg_finish_compress(&info);
+  jpeg_destroy_compress(&info);
+  free(row);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,40 @@
+//
+// jpegencoder.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_JPEG_ENCODER_H__
+#define __NODE_JPEG_ENCODER_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Encoder options.
+ */
+
+typedef struct {
+  int quality;
+  int progressive;
+} canvas_jpeg_options_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_jpeg_options_init(canvas_jpeg_options_t *opts);
+
+#ifdef HAVE_JPEG
+
+cairo_status_t
+canvas_jpeg_write(
+    cairo_surface_t *surface
+  , canvas_jpeg_options_t *opts
+  , cairo_write_func_t write
+  , void *closure);
+
+#endif
+
+#endif /* __NODE_JPEG_ENCODER_H__ */
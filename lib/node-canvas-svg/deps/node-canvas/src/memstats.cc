@@ -0,0 +1,99 @@
+//
+// memstats.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "memstats.h"
+#include "surfacepool.h"
+#include "arena.h"
+
+/*
+ * Live objects and native bytes per type. Only
+ * touched from the loop thread.
+ */
+
+static long objects[MEMSTATS_TYPES];
+static long bytes[MEMSTATS_TYPES];
+
+/*
+ * Type names as reported by memoryStats().
+ */
+
+static const char *names[MEMSTATS_TYPES] = {
+    "canvas"
+  , "image"
+  , "context2d"
+  , "gradient"
+  , "pixelArray"
+};
+
+/*
+ * Adjust the live object count of `type`.
+ */
+
+void
+memstats_object(memstats_type_t type, int delta) {
+  objects[type] += delta;
+}
+
+/*
+ * Adjust the native bytes held by `type`, hinting V8
+ * so that GC pressure reflects the native heap.
+ */
+
+void
+memstats_bytes(memstats_type_t type, long delta) {
+  if (!delta) return;
+  bytes[type] += delta;
+  V8::AdjustAmountOfExternalAllocatedMemory(delta);
+}
+
+/*
+ * Build the memoryStats() object:
+ *
+ *   { canvas: { objects: n, bytes: n }, ...
+ *   , surfacePool: { blocks: n, bytes: n }
+ *   , scratch: { blocks: n, bytes: n, mallocs: n }
+ *   , bytes: n }
+ *
+ * The top-level `bytes` includes memory retained by the
+ * surface pool and scratch arenas, which is not reported
+ * to V8. `scratch.mallocs` counts heap allocations made
+ * by the arenas since startup.
+ */
+
+Local<Object>
+memstats_to_object() {
+  HandleScope scope;
+  Local<Object> obj = Object::New();
+  double total = 0;
+
+  for (int i = 0; i < MEMSTATS_TYPES; ++i) {
+    Local<Object> type = Object::New();
+    type->Set(String::NewSymbol("objects"), Number::New(objects[i]));
+    type->Set(String::NewSymbol("bytes"), Number::New(bytes[i]));
+    obj->Set(String::NewSymbol(names[i]), type);
+    total += bytes[i];
+  }
+
+  surface_pool_stats_t stats;
+  surface_pool_stats(&stats);
+  Local<Object> pool = Object::New();
+  pool->Set(String::NewSymbol("blocks"), Number::New(stats.blocks));
+  pool->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+  obj->Set(String::NewSymbol("surfacePool"), pool);
+  total += stats.bytes;
+
+  canvas_arena_stats_t arena;
+  canvas_arena_stats(&arena);
+  Local<Object> scratch = Object::New();
+  scratch->Set(String::NewSymbol("blocks"), Number::New(arena.blocks));
+  scratch->Set(String::NewSymbol("bytes"), Number::New(arena.bytes));
+  scratch->Set(String::NewSymbol("mallocs"), Number::New(arena.mallocs));
+  obj->Set(String::NewSymbol("scratch"), scratch);
+  total += arena.bytes;
+
+  obj->Set(String::NewSymbol("bytes"), Number::New(total));
+  return scope.Close(obj);
+}
@@ -0,0 +1,46 @@
+//
+// memstats.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_MEMSTATS_H__
+#define __NODE_MEMSTATS_H__
+
+#include <v8.h>
+
+using namespace v8;
+
+/*
+ * Accounted object types.
+ */
+
+typedef enum {
+    MEMSTATS_CANVAS
+  , MEMSTATS_IMAGE
+  , MEMSTATS_CONTEXT2D
+  , MEMSTATS_GRADIENT
+  , MEMSTATS_PIXELARRAY
+  , MEMSTATS_TYPES
+} memstats_type_t;
+
+/*
+ * Estimated bytes held by cairo per gradient color stop.
+ */
+
+#define MEMSTATS_COLOR_STOP_BYTES 48
+
+/*
+ * Prototypes.
+ */
+
+void
+memstats_object(memstats_type_t type, int delta);
+
+void
+memstats_bytes(memstats_type_t type, long delta);
+
+Local<Object>
+memstats_to_object();
+
+#endif /* __NODE_MEMSTATS_H__ */
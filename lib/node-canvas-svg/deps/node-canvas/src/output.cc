@@ -0,0 +1,89 @@
+//
+// output.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Initialize `out` with room for `hint` bytes,
+ * typically the size of the previous encode.
+ */
+
+cairo_status_t
+output_buffer_init(output_buffer_t *out, size_t hint) {
+  out->len = 0;
+  out->owned = 1;
+  out->max = hint > OUTPUT_BUFFER_MIN ? hint : OUTPUT_BUFFER_MIN;
+  out->data = (uint8_t *) malloc(out->max);
+  return out->data
+    ? CAIRO_STATUS_SUCCESS
+    : (out->max = 0, CAIRO_STATUS_NO_MEMORY);
+}
+
+/*
+ * Initialize `out` over caller-supplied memory of `max` bytes.
+ */
+
+void
+output_buffer_init_for_data(output_buffer_t *out, uint8_t *data, size_t max) {
+  out->data = data;
+  out->len = 0;
+  out->max = max;
+  out->owned = 0;
+}
+
+/*
+ * cairo_write_func_t appending `len` bytes, doubling
+ * capacity as needed. Sizes that cannot be represented
+ * fail with CAIRO_STATUS_NO_MEMORY.
+ */
+
+cairo_status_t
+output_buffer_write(void *c, const uint8_t *data, unsigned len) {
+  output_buffer_t *out = (output_buffer_t *) c;
+
+  if (len > out->max - out->len) {
+    if (!out->owned) return CAIRO_STATUS_WRITE_ERROR;
+    if (len > (size_t) -1 - out->len) return CAIRO_STATUS_NO_MEMORY;
+    size_t need = out->len + len
+      , max = out->max ? out->max : OUTPUT_BUFFER_MIN;
+    while (max < need) {
+      max = max > (size_t) -1 / 2 ? need : max * 2;
+    }
+    uint8_t *grown = (uint8_t *) realloc(out->data, max);
+    if (!grown) return CAIRO_STATUS_NO_MEMORY;
+    out->data = grown;
+    out->max = max;
+  }
+
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/*
+ * Hand ownership of the data to the caller.
+ */
+
+uint8_t *
+output_buffer_release(output_buffer_t *out) {
+  uint8_t *data = out->data;
+  out->data = NULL;
+  out->len = out->max = 0;
+  return data;
+}
+
+/*
+ * Free owned data.
+ */
+
+void
+output_buffer_free(output_buffer_t *out) {
+  if (out->owned) free(out->data);
+  out->data = NULL;
+  out->len = out->max = 0;
+}
@@ -0,0 +1,57 @@
+//
+// output.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_OUTPUT_H__
+#define __NODE_OUTPUT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cairo.h>
+
+/*
+ * Initial capacity when no size hint is available.
+ */
+
+#ifndef OUTPUT_BUFFER_MIN
+#define OUTPUT_BUFFER_MIN 4096
+#endif
+
+/*
+ * Encoder output buffer.
+ *
+ * Grows geometrically, so assembling n bytes costs O(n)
+ * regardless of how cairo chunks its writes. When `owned`
+ * is 0 the data is caller-supplied and never grown or freed.
+ * Sizes are size_t so outputs past 4GB grow or fail cleanly.
+ */
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t max;
+  short owned;
+} output_buffer_t;
+
+/*
+ * Prototypes.
+ */
+
+cairo_status_t
+output_buffer_init(output_buffer_t *out, size_t hint);
+
+void
+output_buffer_init_for_data(output_buffer_t *out, uint8_t *data, size_t max);
+
+cairo_status_t
+output_buffer_write(void *c, const uint8_t *data, unsigned len);
+
+uint8_t *
+output_buffer_release(output_buffer_t *out);
+
+void
+output_buffer_free(output_buffer_t *out);
+
+#endif /* __NODE_OUTPUT_H__ */
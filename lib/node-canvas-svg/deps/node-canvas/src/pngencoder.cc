@@ -0,0 +1,862 @@
+//
+// pngencoder.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "pngencoder.h"
+#include "quantize.h"
+#include "output.h"
+#include "format.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/*
+ * Max IDAT chunk payload emitted by the zlib backend.
+ */
+
+#define IDAT_SIZE 32768
+
+/*
+ * Deflate window, also the preset dictionary size of each strip.
+ */
+
+#define WINDOW_SIZE 32768
+
+/*
+ * PNG signature.
+ */
+
+static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+/*
+ * Filter types as written in each row.
+ */
+
+enum {
+    FILTER_NONE
+  , FILTER_SUB
+  , FILTER_UP
+  , FILTER_AVG
+  , FILTER_PAETH
+  , FILTER_COUNT
+};
+
+/*
+ * Encoder state.
+ */
+
+typedef struct {
+  cairo_write_func_t write;
+  void *closure;
+  const canvas_png_options_t *opts;
+  int filters;
+  cairo_format_t format;
+  uint8_t *data;
+  int stride;
+  palette_t *palette;
+  uint8_t remap[PALETTE_MAX];
+  int width;
+  int height;
+  int bpp;
+  unsigned rowbytes;
+  uint8_t *prev;
+  uint8_t *row;
+  uint8_t *filtered[FILTER_COUNT];
+} png_encoder_t;
+
+/*
+ * Horizontal strip deflated on its own thread.
+ */
+
+typedef struct {
+  png_encoder_t enc;
+  int start;
+  int end;
+  int last;
+  uLong adler;
+  output_buffer_t out;
+  cairo_status_t status;
+} strip_t;
+
+/*
+ * Strips of an encode, handed out in order under `lock`
+ * to the threads deflating them.
+ */
+
+typedef struct {
+  strip_t *strips;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+} strip_work_t;
+
+/*
+ * Strip threads available across all encodes, one per
+ * CPU, so concurrent encodes on the thread pool share the
+ * cores rather than each starting `strips` threads.
+ */
+
+static pthread_mutex_t spareLock = PTHREAD_MUTEX_INITIALIZER;
+static int spareThreads = -1;
+
+/*
+ * Initialize default options, deferring to cairo.
+ */
+
+void
+canvas_png_options_init(canvas_png_options_t *opts) {
+  opts->compressionLevel = 6;
+  opts->filters = CANVAS_PNG_ALL_FILTERS;
+  opts->palette = 0;
+  opts->dither = 0;
+  opts->strips = 1;
+  opts->backend = CANVAS_PNG_BACKEND_CAIRO;
+}
+
+/*
+ * Store `n` big-endian.
+ */
+
+static inline void
+put32(uint8_t *buf, uint32_t n) {
+  buf[0] = n >> 24;
+  buf[1] = n >> 16;
+  buf[2] = n >> 8;
+  buf[3] = n;
+}
+
+/*
+ * Write a chunk of `type` with the given payload.
+ */
+
+static cairo_status_t
+chunk(png_encoder_t *enc, const char *type, const uint8_t *data, unsigned len) {
+  cairo_status_t status;
+  uint8_t head[8], tail[4];
+  put32(head, len);
+  memcpy(head + 4, type, 4);
+
+  uLong crc = crc32(0, head + 4, 4);
+  if (len) crc = crc32(crc, data, len);
+  put32(tail, crc);
+
+  if ((status = enc->write(enc->closure, head, 8))) return status;
+  if (len && (status = enc->write(enc->closure, data, len))) return status;
+  return enc->write(enc->closure, tail, 4);
+}
+
+/*
+ * Check if every pixel of the ARGB32 surface is opaque.
+ */
+
+static int
+opaque(uint8_t *data, int width, int height, int stride) {
+  for (int y = 0; y < height; ++y) {
+    uint32_t *row = (uint32_t *)(data + stride * y);
+    for (int x = 0; x < width; ++x) {
+      if ((row[x] >> 24) != 0xff) return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Convert a premultiplied ARGB32 row to RGB(A).
+ */
+
+static void
+unpremultiply(png_encoder_t *enc, uint32_t *src, uint8_t *dst) {
+  if (3 == enc->bpp) {
+    for (int x = 0; x < enc->width; ++x) {
+      uint32_t pixel = src[x];
+      *dst++ = pixel >> 16;
+      *dst++ = pixel >> 8;
+      *dst++ = pixel;
+    }
+    return;
+  }
+
+  for (int x = 0; x < enc->width; ++x) {
+    uint32_t pixel = src[x];
+    uint8_t a = pixel >> 24;
+    if (0 == a) {
+      *dst++ = 0; *dst++ = 0; *dst++ = 0; *dst++ = 0;
+    } else if (0xff == a) {
+      *dst++ = pixel >> 16;
+      *dst++ = pixel >> 8;
+      *dst++ = pixel;
+      *dst++ = 0xff;
+    } else {
+      *dst++ = (((pixel >> 16) & 0xff) * 255 + a / 2) / a;
+      *dst++ = (((pixel >> 8) & 0xff) * 255 + a / 2) / a;
+      *dst++ = ((pixel & 0xff) * 255 + a / 2) / a;
+      *dst++ = a;
+    }
+  }
+}
+
+/*
+ * Expand an RGB16_565 row to RGB.
+ */
+
+static void
+expand565(png_encoder_t *enc, uint16_t *src, uint8_t *dst) {
+  for (int x = 0; x < enc->width; ++x) {
+    uint16_t pixel = src[x];
+    uint8_t r = (pixel >> 11) & 0x1f
+      , g = (pixel >> 5) & 0x3f
+      , b = pixel & 0x1f;
+    *dst++ = r << 3 | r >> 2;
+    *dst++ = g << 2 | g >> 4;
+    *dst++ = b << 3 | b >> 2;
+  }
+}
+
+/*
+ * Load row `y` into the current row, either unpremultiplied
+ * RGB(A), gray from A8 alpha, or palette indices.
+ */
+
+static void
+loadRow(png_encoder_t *enc, int y) {
+  uint8_t *src = enc->data + enc->stride * y;
+  if (enc->palette) {
+    uint8_t *indices = enc->palette->indices + enc->width * y
+      , *dst = enc->row;
+    for (int x = 0; x < enc->width; ++x)
+      dst[x] = enc->remap[indices[x]];
+  } else if (CAIRO_FORMAT_A8 == enc->format) {
+    memcpy(enc->row, src, enc->width);
+  } else if (CAIRO_FORMAT_RGB16_565 == enc->format) {
+    expand565(enc, (uint16_t *) src, enc->row);
+  } else {
+    unpremultiply(enc, (uint32_t *) src, enc->row);
+  }
+}
+
+/*
+ * Paeth predictor.
+ */
+
+static inline uint8_t
+paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = a + b - c
+    , pa = abs(p - a)
+    , pb = abs(p - b)
+    , pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+/*
+ * Apply `type` to the current row, writing the
+ * filter byte followed by the filtered bytes.
+ */
+
+static void
+filter(png_encoder_t *enc, int type, uint8_t *out) {
+  uint8_t *row = enc->row
+    , *prev = enc->prev;
+  unsigned len = enc->rowbytes;
+  int bpp = enc->bpp;
+
+  *out++ = type;
+  switch (type) {
+    case FILTER_NONE:
+      memcpy(out, row, len);
+      break;
+    case FILTER_SUB:
+      for (unsigned i = 0; i < len; ++i)
+        out[i] = row[i] - (i >= (unsigned) bpp ? row[i - bpp] : 0);
+      break;
+    case FILTER_UP:
+      for (unsigned i = 0; i < len; ++i)
+        out[i] = row[i] - prev[i];
+      break;
+    case FILTER_AVG:
+      for (unsigned i = 0; i < len; ++i)
+        out[i] = row[i] - (((i >= (unsigned) bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+      break;
+    case FILTER_PAETH:
+      for (unsigned i = 0; i < len; ++i) {
+        uint8_t a = i >= (unsigned) bpp ? row[i - bpp] : 0
+          , c = i >= (unsigned) bpp ? prev[i - bpp] : 0;
+        out[i] = row[i] - paeth(a, prev[i], c);
+      }
+      break;
+  }
+}
+
+/*
+ * Filter the current row with the allowed filter minimizing
+ * the sum of absolute differences, returning the filtered row.
+ */
+
+static uint8_t *
+filterRow(png_encoder_t *enc) {
+  int filters = enc->filters
+    , best = -1;
+  unsigned long bestSum = 0;
+
+  for (int type = 0; type < FILTER_COUNT; ++type) {
+    if (!(filters & (1 << type))) continue;
+    uint8_t *out = enc->filtered[type];
+    filter(enc, type, out);
+
+    // Single filter allowed, no need to score
+    if (filters == (1 << type)) return out;
+
+    unsigned long sum = 0;
+    for (unsigned i = 1; i <= enc->rowbytes; ++i)
+      sum += out[i] < 128 ? out[i] : 256 - out[i];
+    if (best < 0 || sum < bestSum) best = type, bestSum = sum;
+  }
+
+  return enc->filtered[best];
+}
+
+/*
+ * Swap the current and previous rows.
+ */
+
+static inline void
+advance(png_encoder_t *enc) {
+  uint8_t *tmp = enc->prev;
+  enc->prev = enc->row;
+  enc->row = tmp;
+}
+
+/*
+ * Allocate row buffers, prev starts zeroed for
+ * the first row's UP / AVG / PAETH.
+ */
+
+static cairo_status_t
+allocRows(png_encoder_t *enc) {
+  enc->prev = (uint8_t *) calloc(enc->rowbytes, 1);
+  enc->row = (uint8_t *) malloc(enc->rowbytes);
+  if (!enc->prev || !enc->row) return CAIRO_STATUS_NO_MEMORY;
+
+  for (int type = 0; type < FILTER_COUNT; ++type) {
+    if (!(enc->filters & (1 << type))) continue;
+    if (!(enc->filtered[type] = (uint8_t *) malloc(enc->rowbytes + 1)))
+      return CAIRO_STATUS_NO_MEMORY;
+  }
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/*
+ * Free row buffers.
+ */
+
+static void
+freeRows(png_encoder_t *enc) {
+  free(enc->prev);
+  free(enc->row);
+  enc->prev = enc->row = NULL;
+  for (int type = 0; type < FILTER_COUNT; ++type) {
+    free(enc->filtered[type]);
+    enc->filtered[type] = NULL;
+  }
+}
+
+/*
+ * zlib strategy for the allowed filters.
+ */
+
+static inline int
+strategy(png_encoder_t *enc) {
+  return CANVAS_PNG_FILTER_NONE == enc->filters
+    ? Z_DEFAULT_STRATEGY
+    : Z_FILTERED;
+}
+
+/*
+ * Deflate rows with zlib, streaming IDAT chunks.
+ */
+
+static cairo_status_t
+deflateZlib(png_encoder_t *enc) {
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  uint8_t out[IDAT_SIZE];
+  z_stream zs;
+  memset(&zs, 0, sizeof(z_stream));
+
+  if (Z_OK != deflateInit2(&zs, enc->opts->compressionLevel, Z_DEFLATED, 15, 8, strategy(enc)))
+    return CAIRO_STATUS_NO_MEMORY;
+
+  zs.next_out = out;
+  zs.avail_out = IDAT_SIZE;
+
+  for (int y = 0; y <= enc->height; ++y) {
+    int flush = Z_NO_FLUSH;
+    if (y < enc->height) {
+      loadRow(enc, y);
+      zs.next_in = filterRow(enc);
+      zs.avail_in = enc->rowbytes + 1;
+      advance(enc);
+    } else {
+      zs.avail_in = 0;
+      flush = Z_FINISH;
+    }
+
+    for (;;) {
+      int ret = deflate(&zs, flush);
+      if (Z_STREAM_ERROR == ret) {
+        status = CAIRO_STATUS_NO_MEMORY;
+        goto done;
+      }
+      if (0 == zs.avail_out || (Z_STREAM_END == ret && zs.avail_out < IDAT_SIZE)) {
+        if ((status = chunk(enc, "IDAT", out, IDAT_SIZE - zs.avail_out))) goto done;
+        zs.next_out = out;
+        zs.avail_out = IDAT_SIZE;
+      }
+      if (Z_STREAM_END == ret) break;
+      if (Z_NO_FLUSH == flush && 0 == zs.avail_in && zs.avail_out) break;
+    }
+  }
+
+done:
+  deflateEnd(&zs);
+  return status;
+}
+
+/*
+ * Deflate a strip to raw deflate data, ending on a byte
+ * boundary with a sync flush, or the final block for the
+ * last strip. As with pigz the strip is primed with the
+ * preceding WINDOW_SIZE bytes of filtered data, recomputed
+ * here, so matches may still span strips.
+ */
+
+static void *
+deflateStrip(void *data) {
+  strip_t *strip = (strip_t *) data;
+  png_encoder_t *enc = &strip->enc;
+  unsigned linelen = enc->rowbytes + 1;
+  uint8_t out[IDAT_SIZE], *dict = NULL;
+  cairo_status_t status;
+  z_stream zs;
+  memset(&zs, 0, sizeof(z_stream));
+  strip->adler = adler32(0, NULL, 0);
+
+  if ((status = allocRows(enc))) goto done;
+
+  if (Z_OK != deflateInit2(&zs, enc->opts->compressionLevel, Z_DEFLATED, -15, 8, strategy(enc))) {
+    status = CAIRO_STATUS_NO_MEMORY;
+    goto done;
+  }
+
+  // Preset dictionary, leaving prev as the row above the strip
+  if (strip->start) {
+    int rows = (WINDOW_SIZE + linelen - 1) / linelen;
+    if (rows > strip->start) rows = strip->start;
+    int y = strip->start - rows;
+    if (y) {
+      loadRow(enc, y - 1);
+      advance(enc);
+    }
+    if (!(dict = (uint8_t *) malloc(rows * linelen))) {
+      status = CAIRO_STATUS_NO_MEMORY;
+      goto done;
+    }
+    for (int i = 0; y < strip->start; ++y, ++i) {
+      loadRow(enc, y);
+      memcpy(dict + i * linelen, filterRow(enc), linelen);
+      advance(enc);
+    }
+    unsigned len = rows * linelen
+      , off = len > WINDOW_SIZE ? len - WINDOW_SIZE : 0;
+    deflateSetDictionary(&zs, dict + off, len - off);
+  }
+
+  zs.next_out = out;
+  zs.avail_out = IDAT_SIZE;
+
+  for (int y = strip->start; y <= strip->end; ++y) {
+    int flush = Z_NO_FLUSH;
+    if (y < strip->end) {
+      loadRow(enc, y);
+      zs.next_in = filterRow(enc);
+      zs.avail_in = linelen;
+      strip->adler = adler32(strip->adler, zs.next_in, linelen);
+      advance(enc);
+    } else {
+      zs.avail_in = 0;
+      flush = strip->last ? Z_FINISH : Z_SYNC_FLUSH;
+    }
+
+    for (;;) {
+      int ret = deflate(&zs, flush);
+      if (Z_STREAM_ERROR == ret) {
+        status = CAIRO_STATUS_NO_MEMORY;
+        goto done;
+      }
+      int full = 0 == zs.avail_out;
+      if (full || Z_NO_FLUSH != flush) {
+        if ((status = output_buffer_write(&strip->out, out, IDAT_SIZE - zs.avail_out))) goto done;
+        zs.next_out = out;
+        zs.avail_out = IDAT_SIZE;
+      }
+      if (Z_STREAM_END == ret) break;
+      // Sync flush is complete once deflate() leaves output space
+      if (!full && 0 == zs.avail_in && Z_FINISH != flush) break;
+    }
+  }
+
+done:
+  deflateEnd(&zs);
+  free(dict);
+  freeRows(enc);
+  strip->status = status;
+  return NULL;
+}
+
+/*
+ * Take up to `n` of the spare strip threads.
+ */
+
+static int
+reserveThreads(int n) {
+  pthread_mutex_lock(&spareLock);
+  if (spareThreads < 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    spareThreads = cpus < 1 ? 1 : cpus > CANVAS_PNG_MAX_STRIPS ? CANVAS_PNG_MAX_STRIPS : cpus;
+  }
+  if (n > spareThreads) n = spareThreads;
+  spareThreads -= n;
+  pthread_mutex_unlock(&spareLock);
+  return n;
+}
+
+/*
+ * Return `n` strip threads.
+ */
+
+static void
+releaseThreads(int n) {
+  pthread_mutex_lock(&spareLock);
+  spareThreads += n;
+  pthread_mutex_unlock(&spareLock);
+}
+
+/*
+ * Strip thread, deflating strips until they run out.
+ */
+
+static void *
+deflateStrips(void *data) {
+  strip_work_t *work = (strip_work_t *) data;
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    int i = work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (i >= work->count) break;
+    deflateStrip(&work->strips[i]);
+  }
+  return NULL;
+}
+
+/*
+ * Deflate horizontal strips concurrently, joining them
+ * into a single zlib stream written as one IDAT per strip.
+ * The strips, and so the output, are as requested, but
+ * they are shared by the calling thread and whatever spare
+ * strip threads remain, see reserveThreads().
+ */
+
+static cairo_status_t
+deflateParallel(png_encoder_t *enc) {
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  int n = enc->opts->strips;
+  if (n > CANVAS_PNG_MAX_STRIPS) n = CANVAS_PNG_MAX_STRIPS;
+  if (n > enc->height) n = enc->height;
+
+  strip_t *strips = (strip_t *) calloc(n, sizeof(strip_t));
+  if (!strips) return CAIRO_STATUS_NO_MEMORY;
+
+  for (int i = 0; i < n && !status; ++i) {
+    strip_t *strip = &strips[i];
+    strip->enc = *enc;
+    strip->start = (int) ((long) enc->height * i / n);
+    strip->end = (int) ((long) enc->height * (i + 1) / n);
+    strip->last = i == n - 1;
+    status = output_buffer_init(&strip->out, 0);
+  }
+
+  if (!status) {
+    strip_work_t work;
+    work.strips = strips;
+    work.count = n;
+    work.next = 0;
+    pthread_mutex_init(&work.lock, NULL);
+
+    pthread_t tids[CANVAS_PNG_MAX_STRIPS];
+    int threads = reserveThreads(n - 1)
+      , started = 0;
+    while (started < threads
+      && !pthread_create(&tids[started], NULL, deflateStrips, &work))
+      ++started;
+    releaseThreads(threads - started);
+
+    deflateStrips(&work);
+    for (int i = 0; i < started; ++i)
+      pthread_join(tids[i], NULL);
+    releaseThreads(started);
+    pthread_mutex_destroy(&work.lock);
+
+    for (int i = 0; i < n && !status; ++i)
+      status = strips[i].status;
+  }
+
+  if (!status) {
+    // zlib header, deflate with a 32K window and no dictionary
+    int level = enc->opts->compressionLevel;
+    uint8_t head[2] = { 0x78, (uint8_t) ((level < 2 ? 0 : level < 6 ? 1 : 6 == level ? 2 : 3) << 6) };
+    head[1] += 31 - (head[0] * 256 + head[1]) % 31;
+
+    // adler32 trailer of the whole filtered image
+    uLong adler = strips[0].adler;
+    for (int i = 1; i < n; ++i) {
+      long len = (long) (strips[i].end - strips[i].start) * (enc->rowbytes + 1);
+      adler = adler32_combine(adler, strips[i].adler, len);
+    }
+    uint8_t tail[4];
+    put32(tail, adler);
+
+    if (!(status = output_buffer_write(&strips[n - 1].out, tail, 4))) {
+      // Header goes in its own IDAT rather than shifting the first strip
+      if (!(status = chunk(enc, "IDAT", head, 2))) {
+        for (int i = 0; i < n && !status; ++i)
+          status = chunk(enc, "IDAT", strips[i].out.data, strips[i].out.len);
+      }
+    }
+  }
+
+  for (int i = 0; i < n; ++i) output_buffer_free(&strips[i].out);
+  free(strips);
+  return status;
+}
+
+#ifdef HAVE_LIBDEFLATE
+
+/*
+ * Deflate the whole filtered image with libdeflate,
+ * which only supports one-shot compression.
+ */
+
+static cairo_status_t
+deflateLibdeflate(png_encoder_t *enc) {
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  size_t len = (size_t) (enc->rowbytes + 1) * enc->height;
+  uint8_t *in = NULL, *out = NULL;
+
+  struct libdeflate_compressor *compressor =
+    libdeflate_alloc_compressor(enc->opts->compressionLevel);
+  if (!compressor) return CAIRO_STATUS_NO_MEMORY;
+
+  size_t bound = libdeflate_zlib_compress_bound(compressor, len);
+  in = (uint8_t *) malloc(len);
+  out = (uint8_t *) malloc(bound);
+  if (!in || !out) {
+    status = CAIRO_STATUS_NO_MEMORY;
+    goto done;
+  }
+
+  for (int y = 0; y < enc->height; ++y) {
+    loadRow(enc, y);
+    memcpy(in + (enc->rowbytes + 1) * y, filterRow(enc), enc->rowbytes + 1);
+    advance(enc);
+  }
+
+  len = libdeflate_zlib_compress(compressor, in, len, out, bound);
+  if (!len) {
+    status = CAIRO_STATUS_NO_MEMORY;
+    goto done;
+  }
+
+  for (size_t off = 0; off < len; off += 0x7fffffff) {
+    size_t n = len - off > 0x7fffffff ? 0x7fffffff : len - off;
+    if ((status = chunk(enc, "IDAT", out + off, n))) break;
+  }
+
+done:
+  free(in);
+  free(out);
+  libdeflate_free_compressor(compressor);
+  return status;
+}
+
+#endif
+
+/*
+ * Write the PLTE chunk, and tRNS when any entry is translucent.
+ * Translucent entries are ordered first so tRNS can stop at the
+ * last of them, `remap` maps quantizer indices to written ones.
+ */
+
+static cairo_status_t
+writePalette(png_encoder_t *enc) {
+  cairo_status_t status;
+  palette_t *palette = enc->palette;
+  uint8_t plte[PALETTE_MAX * 3], trns[PALETTE_MAX];
+  int n = 0, ntrns;
+
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < palette->count; ++i) {
+      uint8_t *color = palette->colors[i];
+      if ((0xff == color[3]) != pass) continue;
+      enc->remap[i] = n;
+      plte[n * 3] = color[0];
+      plte[n * 3 + 1] = color[1];
+      plte[n * 3 + 2] = color[2];
+      trns[n++] = color[3];
+    }
+    if (!pass) ntrns = n;
+  }
+
+  if ((status = chunk(enc, "PLTE", plte, n * 3))) return status;
+  if (ntrns) return chunk(enc, "tRNS", trns, ntrns);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/*
+ * Index the surface into `palette`, converting formats other
+ * than ARGB32 to a temporary ARGB32 copy first.
+ */
+
+static cairo_status_t
+quantizeSurface(png_encoder_t *enc, palette_t *palette) {
+  if (CAIRO_FORMAT_ARGB32 == enc->format)
+    return palette_quantize(enc->data, enc->width, enc->height, enc->stride, enc->opts->dither, palette);
+
+  int stride = enc->width * 4;
+  uint8_t *argb = (uint8_t *) malloc((size_t) stride * enc->height);
+  if (!argb) return CAIRO_STATUS_NO_MEMORY;
+  for (int y = 0; y < enc->height; ++y)
+    canvas_format_to_argb32(enc->format, enc->data + enc->stride * y, (uint32_t *)(argb + stride * y), enc->width);
+
+  cairo_status_t status = palette_quantize(argb, enc->width, enc->height, stride, enc->opts->dither, palette);
+  free(argb);
+  return status;
+}
+
+/*
+ * Encode `surface` as PNG, passing the bytes to `write`.
+ * CANVAS_PNG_BACKEND_CAIRO defers to cairo_surface_write_to_png_stream(),
+ * other than for RGB16_565 which cairo cannot write.
+ * With `opts->palette` an 8-bit indexed PNG is written, see quantize.cc.
+ *
+ * ARGB32 is written as RGBA, or RGB when opaque, RGB24 and
+ * RGB16_565 as RGB, and A8 as 8-bit gray as cairo does.
+ */
+
+cairo_status_t
+canvas_png_write(
+    cairo_surface_t *surface
+  , const canvas_png_options_t *opts
+  , cairo_write_func_t write
+  , void *closure) {
+
+  cairo_format_t format = cairo_image_surface_get_format(surface);
+  if (CANVAS_PNG_BACKEND_CAIRO == opts->backend && CAIRO_FORMAT_RGB16_565 != format)
+    return cairo_surface_write_to_png_stream(surface, write, closure);
+
+#ifndef HAVE_LIBDEFLATE
+  if (CANVAS_PNG_BACKEND_LIBDEFLATE == opts->backend)
+    return CAIRO_STATUS_INVALID_FORMAT;
+#endif
+
+  switch (format) {
+    case CAIRO_FORMAT_ARGB32:
+    case CAIRO_FORMAT_RGB24:
+    case CAIRO_FORMAT_A8:
+    case CAIRO_FORMAT_RGB16_565:
+      break;
+    default:
+      return CAIRO_STATUS_INVALID_FORMAT;
+  }
+
+  cairo_status_t status;
+  cairo_surface_flush(surface);
+
+  uint8_t *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+
+  palette_t palette;
+  png_encoder_t enc;
+  memset(&enc, 0, sizeof(png_encoder_t));
+  enc.write = write;
+  enc.closure = closure;
+  enc.opts = opts;
+  enc.format = format;
+  enc.data = data;
+  enc.stride = stride;
+  enc.width = cairo_image_surface_get_width(surface);
+  enc.height = cairo_image_surface_get_height(surface);
+
+  // A8 is already 8-bit gray, no palette needed
+  if (CAIRO_FORMAT_A8 == format) {
+    enc.bpp = 1;
+  } else if (opts->palette) {
+    if ((status = quantizeSurface(&enc, &palette))) return status;
+    enc.palette = &palette;
+    enc.bpp = 1;
+  } else if (CAIRO_FORMAT_ARGB32 == format) {
+    enc.bpp = opaque(data, enc.width, enc.height, stride) ? 3 : 4;
+  } else {
+    enc.bpp = 3;
+  }
+  enc.rowbytes = enc.width * enc.bpp;
+
+  enc.filters = opts->filters & CANVAS_PNG_ALL_FILTERS
+    ? opts->filters
+    : CANVAS_PNG_FILTER_NONE;
+
+  // Signature
+  if ((status = write(closure, signature, 8))) goto done;
+
+  // IHDR: 8-bit gray, indexed, RGB or RGBA, no interlace
+  uint8_t ihdr[13];
+  put32(ihdr, enc.width);
+  put32(ihdr + 4, enc.height);
+  ihdr[8] = 8;
+  ihdr[9] = enc.palette ? 3 : 1 == enc.bpp ? 0 : 3 == enc.bpp ? 2 : 6;
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  if ((status = chunk(&enc, "IHDR", ihdr, 13))) goto done;
+
+  // PLTE / tRNS
+  if (enc.palette && (status = writePalette(&enc))) goto done;
+
+  // IDAT, strips allocate their own rows
+  if (CANVAS_PNG_BACKEND_ZLIB == opts->backend && opts->strips > 1 && enc.height > 1) {
+    status = deflateParallel(&enc);
+  } else if (!(status = allocRows(&enc))) {
+#ifdef HAVE_LIBDEFLATE
+    if (CANVAS_PNG_BACKEND_LIBDEFLATE == opts->backend) {
+      status = deflateLibdeflate(&enc);
+    } else {
+      status = deflateZlib(&enc);
+    }
+#else
+    status = deflateZlib(&enc);
+#endif
+  }
+  if (status) goto done;
+
+  status = chunk(&enc, "IEND", NULL, 0);
+
+done:
+  if (enc.palette) palette_free(enc.palette);
+  freeRows(&enc);
+  return status;
+}
@@ -0,0 +1,71 @@
+//
+// pngencoder.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_PNG_ENCODER_H__
+#define __NODE_PNG_ENCODER_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Row filters, combined as a bitmask. When several
+ * are allowed the one with the smallest sum of absolute
+ * differences is chosen per row.
+ */
+
+#define CANVAS_PNG_FILTER_NONE  0x01
+#define CANVAS_PNG_FILTER_SUB   0x02
+#define CANVAS_PNG_FILTER_UP    0x04
+#define CANVAS_PNG_FILTER_AVG   0x08
+#define CANVAS_PNG_FILTER_PAETH 0x10
+#define CANVAS_PNG_ALL_FILTERS  0x1f
+
+/*
+ * Max strips deflated concurrently.
+ */
+
+#ifndef CANVAS_PNG_MAX_STRIPS
+#define CANVAS_PNG_MAX_STRIPS 64
+#endif
+
+/*
+ * Deflate backends.
+ */
+
+typedef enum {
+    CANVAS_PNG_BACKEND_CAIRO
+  , CANVAS_PNG_BACKEND_ZLIB
+  , CANVAS_PNG_BACKEND_LIBDEFLATE
+} canvas_png_backend_t;
+
+/*
+ * Encoder options.
+ */
+
+typedef struct {
+  int compressionLevel;
+  int filters;
+  int palette;
+  int dither;
+  int strips;
+  canvas_png_backend_t backend;
+} canvas_png_options_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_png_options_init(canvas_png_options_t *opts);
+
+cairo_status_t
+canvas_png_write(
+    cairo_surface_t *surface
+  , const canvas_png_options_t *opts
+  , cairo_write_func_t write
+  , void *closure);
+
+#endif /* __NODE_PNG_ENCODER_H__ */
@@ -0,0 +1,388 @@
+//
+// premultiply.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "premultiply.h"
+#include <string.h>
+
+#if !defined(CANVAS_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_X86_KERNELS 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if !defined(CANVAS_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Both directions round to nearest:
+ *
+ *   unpremultiply  c' = (c * 255 + a / 2) / a, 0 when a is 0
+ *   premultiply    c' = (c * a + 127) / 255
+ *
+ * Division by alpha is a multiply by recip[a], the 16.16
+ * reciprocal of a / 255 rounded up, which is exact for
+ * every c <= a. Larger (invalid) colour values are clamped
+ * to a first. Division by 255 uses the usual exact
+ * (t + (t >> 8)) >> 8 with t = c * a + 128.
+ *
+ * Every kernel produces identical output.
+ */
+
+static uint32_t recip[256];
+
+/*
+ * Kernel.
+ */
+
+typedef struct {
+  const char *name;
+  void (*unpremultiply)(const uint32_t *src, uint8_t *dst, int width);
+  void (*premultiply)(const uint8_t *src, uint32_t *dst, int width);
+  int (*supported)();
+} kernel_t;
+
+/*
+ * Fill the reciprocal table.
+ */
+
+static void
+initRecip() {
+  recip[0] = 0;
+  for (uint32_t a = 1; a < 256; ++a)
+    recip[a] = ((255u << 16) + a - 1) / a;
+}
+
+/*
+ * Scalar kernels.
+ */
+
+static inline uint8_t
+div255(uint32_t c, uint32_t a) {
+  uint32_t t = c * a + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static inline uint8_t
+unmul(uint32_t c, uint32_t a) {
+  if (c > a) c = a;
+  return (c * recip[a] + 0x8000) >> 16;
+}
+
+static void
+unpremultiplyScalar(const uint32_t *src, uint8_t *dst, int width) {
+  for (int x = 0; x < width; ++x, dst += 4) {
+    uint32_t pixel = src[x]
+      , a = pixel >> 24;
+    if (0xff == a) {
+      dst[0] = pixel >> 16;
+      dst[1] = pixel >> 8;
+      dst[2] = pixel;
+    } else {
+      dst[0] = unmul((pixel >> 16) & 0xff, a);
+      dst[1] = unmul((pixel >> 8) & 0xff, a);
+      dst[2] = unmul(pixel & 0xff, a);
+    }
+    dst[3] = a;
+  }
+}
+
+static void
+premultiplyScalar(const uint8_t *src, uint32_t *dst, int width) {
+  for (int x = 0; x < width; ++x, src += 4) {
+    uint32_t a = src[3];
+    dst[x] = a << 24
+      | div255(src[0], a) << 16
+      | div255(src[1], a) << 8
+      | div255(src[2], a);
+  }
+}
+
+static int
+supportedScalar() {
+  return 1;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * 32-bit lane multiply, SSE2 only has the even lanes.
+ */
+
+static inline __m128i
+mullo32(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b)
+    , odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(
+      _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0))
+    , _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*
+ * Unpremultiply 4 ARGB32 pixels to RGBA, per channel
+ * (min(c, a) * recip[a] + 0x8000) >> 16.
+ */
+
+static inline __m128i
+unpremultiply4(__m128i px, __m128i r) {
+  __m128i mask = _mm_set1_epi32(0xff)
+    , round = _mm_set1_epi32(0x8000)
+    , a = _mm_srli_epi32(px, 24)
+    , c0 = _mm_min_epi16(_mm_and_si128(_mm_srli_epi32(px, 16), mask), a)
+    , c1 = _mm_min_epi16(_mm_and_si128(_mm_srli_epi32(px, 8), mask), a)
+    , c2 = _mm_min_epi16(_mm_and_si128(px, mask), a);
+  c0 = _mm_srli_epi32(_mm_add_epi32(mullo32(c0, r), round), 16);
+  c1 = _mm_srli_epi32(_mm_add_epi32(mullo32(c1, r), round), 16);
+  c2 = _mm_srli_epi32(_mm_add_epi32(mullo32(c2, r), round), 16);
+  return _mm_or_si128(
+      _mm_or_si128(c0, _mm_slli_epi32(c1, 8))
+    , _mm_or_si128(_mm_slli_epi32(c2, 16), _mm_slli_epi32(a, 24)));
+}
+
+static void
+unpremultiplySSE2(const uint32_t *src, uint8_t *dst, int width) {
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i px = _mm_loadu_si128((const __m128i *)(src + x))
+      , r = _mm_set_epi32(
+          recip[src[x + 3] >> 24]
+        , recip[src[x + 2] >> 24]
+        , recip[src[x + 1] >> 24]
+        , recip[src[x] >> 24]);
+    _mm_storeu_si128((__m128i *)(dst + x * 4), unpremultiply4(px, r));
+  }
+  unpremultiplyScalar(src + x, dst + x * 4, width - x);
+}
+
+/*
+ * Premultiply 2 RGBA pixels unpacked to 16-bit lanes,
+ * returning them in ARGB32 (BGRA byte) order.
+ */
+
+static inline __m128i
+premultiply2(__m128i c) {
+  __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0)
+    , a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  a = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), _mm_and_si128(alphaLanes, _mm_set1_epi16(255)));
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+  t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+static void
+premultiplySSE2(const uint8_t *src, uint32_t *dst, int width) {
+  __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i px = _mm_loadu_si128((const __m128i *)(src + x * 4))
+      , lo = premultiply2(_mm_unpacklo_epi8(px, zero))
+      , hi = premultiply2(_mm_unpackhi_epi8(px, zero));
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+  premultiplyScalar(src + x * 4, dst + x, width - x);
+}
+
+static int
+supportedSSE2() {
+  return 1;
+}
+
+/*
+ * AVX2 variants, 8 pixels at a time with the reciprocals
+ * gathered from the table.
+ */
+
+__attribute__((target("avx2")))
+static void
+unpremultiplyAVX2(const uint32_t *src, uint8_t *dst, int width) {
+  __m256i mask = _mm256_set1_epi32(0xff)
+    , round = _mm256_set1_epi32(0x8000);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i px = _mm256_loadu_si256((const __m256i *)(src + x))
+      , a = _mm256_srli_epi32(px, 24)
+      , r = _mm256_i32gather_epi32((const int *) recip, a, 4)
+      , c0 = _mm256_min_epu32(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask), a)
+      , c1 = _mm256_min_epu32(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask), a)
+      , c2 = _mm256_min_epu32(_mm256_and_si256(px, mask), a);
+    c0 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(c0, r), round), 16);
+    c1 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(c1, r), round), 16);
+    c2 = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(c2, r), round), 16);
+    __m256i out = _mm256_or_si256(
+        _mm256_or_si256(c0, _mm256_slli_epi32(c1, 8))
+      , _mm256_or_si256(_mm256_slli_epi32(c2, 16), _mm256_slli_epi32(a, 24)));
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), out);
+  }
+  unpremultiplyScalar(src + x, dst + x * 4, width - x);
+}
+
+__attribute__((target("avx2")))
+static void
+premultiplyAVX2(const uint8_t *src, uint32_t *dst, int width) {
+  __m256i zero = _mm256_setzero_si256()
+    , alphaLanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0)
+    , opaque = _mm256_and_si256(alphaLanes, _mm256_set1_epi16(255))
+    , half = _mm256_set1_epi16(128);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i px = _mm256_loadu_si256((const __m256i *)(src + x * 4))
+      , c[2] = { _mm256_unpacklo_epi8(px, zero), _mm256_unpackhi_epi8(px, zero) };
+    for (int i = 0; i < 2; ++i) {
+      __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c[i], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+      a = _mm256_or_si256(_mm256_andnot_si256(alphaLanes, a), opaque);
+      __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(c[i], a), half);
+      t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+      c[i] = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(t, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_packus_epi16(c[0], c[1]));
+  }
+  premultiplyScalar(src + x * 4, dst + x, width - x);
+}
+
+static int
+supportedAVX2() {
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+/*
+ * NEON variants, 8 pixels at a time deinterleaved
+ * into channel planes.
+ */
+
+static inline uint8x8_t
+unmul8(uint8x8_t c, uint8x8_t a, uint32x4_t rlo, uint32x4_t rhi) {
+  uint16x8_t v = vmovl_u8(vmin_u8(c, a));
+  uint32x4_t lo = vmulq_u32(vmovl_u16(vget_low_u16(v)), rlo)
+    , hi = vmulq_u32(vmovl_u16(vget_high_u16(v)), rhi);
+  return vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, 16), vrshrn_n_u32(hi, 16)));
+}
+
+static void
+unpremultiplyNEON(const uint32_t *src, uint8_t *dst, int width) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint8x8x4_t px = vld4_u8((const uint8_t *)(src + x));
+    uint32_t r[8];
+    for (int i = 0; i < 8; ++i) r[i] = recip[src[x + i] >> 24];
+    uint32x4_t rlo = vld1q_u32(r), rhi = vld1q_u32(r + 4);
+    uint8x8x4_t out;
+    out.val[0] = unmul8(px.val[2], px.val[3], rlo, rhi);
+    out.val[1] = unmul8(px.val[1], px.val[3], rlo, rhi);
+    out.val[2] = unmul8(px.val[0], px.val[3], rlo, rhi);
+    out.val[3] = px.val[3];
+    vst4_u8(dst + x * 4, out);
+  }
+  unpremultiplyScalar(src + x, dst + x * 4, width - x);
+}
+
+static inline uint8x8_t
+mul8(uint8x8_t c, uint8x8_t a) {
+  uint16x8_t t = vaddq_u16(vmull_u8(c, a), vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+
+static void
+premultiplyNEON(const uint8_t *src, uint32_t *dst, int width) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint8x8x4_t px = vld4_u8(src + x * 4), out;
+    out.val[0] = mul8(px.val[2], px.val[3]);
+    out.val[1] = mul8(px.val[1], px.val[3]);
+    out.val[2] = mul8(px.val[0], px.val[3]);
+    out.val[3] = px.val[3];
+    vst4_u8((uint8_t *)(dst + x), out);
+  }
+  premultiplyScalar(src + x * 4, dst + x, width - x);
+}
+
+static int
+supportedNEON() {
+  return 1;
+}
+
+#endif /* HAVE_NEON_KERNELS */
+
+/*
+ * Kernels, preferred first.
+ */
+
+static kernel_t kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    { "avx2", unpremultiplyAVX2, premultiplyAVX2, supportedAVX2 },
+    { "sse2", unpremultiplySSE2, premultiplySSE2, supportedSSE2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "neon", unpremultiplyNEON, premultiplyNEON, supportedNEON },
+#endif
+    { "scalar", unpremultiplyScalar, premultiplyScalar, supportedScalar }
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * Selected kernel, the first supported on first use.
+ */
+
+static kernel_t *kernel;
+
+static kernel_t *
+selected() {
+  if (!kernel) {
+    initRecip();
+    unsigned i = 0;
+    while (!kernels[i].supported()) ++i;
+    kernel = &kernels[i];
+  }
+  return kernel;
+}
+
+/*
+ * Unpremultiply `width` ARGB32 pixels to RGBA bytes.
+ */
+
+void
+canvas_unpremultiply(const uint32_t *src, uint8_t *dst, int width) {
+  selected()->unpremultiply(src, dst, width);
+}
+
+/*
+ * Premultiply `width` RGBA pixels to ARGB32.
+ */
+
+void
+canvas_premultiply(const uint8_t *src, uint32_t *dst, int width) {
+  selected()->premultiply(src, dst, width);
+}
+
+/*
+ * Name of the kernel in use.
+ */
+
+const char *
+canvas_premultiply_kernel() {
+  return selected()->name;
+}
+
+/*
+ * Use the kernel `name` when supported, returning 0 otherwise.
+ */
+
+int
+canvas_premultiply_use(const char *name) {
+  selected();
+  for (unsigned i = 0; i < KERNEL_COUNT; ++i) {
+    if (0 == strcmp(name, kernels[i].name) && kernels[i].supported()) {
+      kernel = &kernels[i];
+      return 1;
+    }
+  }
+  return 0;
+}
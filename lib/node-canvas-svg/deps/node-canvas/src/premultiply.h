@@ -0,0 +1,28 @@
+//
+// premultiply.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_PREMULTIPLY_H__
+#define __NODE_PREMULTIPLY_H__
+
+#include <stdint.h>
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_unpremultiply(const uint32_t *src, uint8_t *dst, int width);
+
+void
+canvas_premultiply(const uint8_t *src, uint32_t *dst, int width);
+
+const char *
+canvas_premultiply_kernel();
+
+int
+canvas_premultiply_use(const char *name);
+
+#endif /* __NODE_PREMULTIPLY_H__ */
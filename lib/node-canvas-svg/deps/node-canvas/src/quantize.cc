@@ -0,0 +1,423 @@
+//
+// quantize.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "quantize.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Exact pass hash table size, a power of two
+ * comfortably larger than PALETTE_MAX.
+ */
+
+#define EXACT_SLOTS 1024
+
+/*
+ * Histogram precision, bits per RGBA channel.
+ */
+
+#define HIST_BITS 5
+#define HIST_SIZE (1 << (HIST_BITS * 4))
+
+/*
+ * Histogram bin shift per channel.
+ */
+
+static const int shift[4] = { 15, 10, 5, 0 };
+
+/*
+ * Histogram bin.
+ */
+
+typedef struct {
+  uint32_t key;
+  uint32_t count;
+} bin_t;
+
+/*
+ * Median cut box over a range of bins.
+ */
+
+typedef struct {
+  int start;
+  int end;
+  uint8_t min[4];
+  uint8_t max[4];
+} box_t;
+
+/*
+ * Unpremultiply an ARGB32 pixel to RGBA.
+ */
+
+static inline void
+unpremultiply(uint32_t pixel, uint8_t *rgba) {
+  uint8_t a = pixel >> 24;
+  if (0 == a) {
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+  } else if (0xff == a) {
+    rgba[0] = pixel >> 16;
+    rgba[1] = pixel >> 8;
+    rgba[2] = pixel;
+    rgba[3] = 0xff;
+  } else {
+    rgba[0] = (((pixel >> 16) & 0xff) * 255 + a / 2) / a;
+    rgba[1] = (((pixel >> 8) & 0xff) * 255 + a / 2) / a;
+    rgba[2] = ((pixel & 0xff) * 255 + a / 2) / a;
+    rgba[3] = a;
+  }
+}
+
+/*
+ * Histogram key for RGBA values.
+ */
+
+static inline uint32_t
+binKey(const int *rgba) {
+  return (rgba[0] >> 3) << 15
+    | (rgba[1] >> 3) << 10
+    | (rgba[2] >> 3) << 5
+    | (rgba[3] >> 3);
+}
+
+/*
+ * Expand channel `c` of `key` back to 8 bits.
+ */
+
+static inline int
+binValue(uint32_t key, int c) {
+  int v = (key >> shift[c]) & 31;
+  return v << 3 | v >> 2;
+}
+
+/*
+ * Attempt to index the surface with its own colors,
+ * returning 0 when it has more than PALETTE_MAX.
+ */
+
+static int
+exact(uint8_t *data, int width, int height, int stride, palette_t *palette) {
+  uint32_t keys[EXACT_SLOTS];
+  int16_t vals[EXACT_SLOTS];
+  memset(vals, 0xff, sizeof(vals));
+
+  uint32_t last = 0;
+  int lastIndex = -1;
+  palette->count = 0;
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *row = (uint32_t *)(data + stride * y);
+    uint8_t *out = palette->indices + width * y;
+    for (int x = 0; x < width; ++x) {
+      uint32_t pixel = row[x];
+      if (lastIndex < 0 || pixel != last) {
+        unsigned slot = (pixel * 2654435761u) >> 22;
+        while (vals[slot] >= 0 && keys[slot] != pixel)
+          slot = (slot + 1) & (EXACT_SLOTS - 1);
+        if (vals[slot] < 0) {
+          if (PALETTE_MAX == palette->count) return 0;
+          keys[slot] = pixel;
+          vals[slot] = palette->count;
+          unpremultiply(pixel, palette->colors[palette->count++]);
+        }
+        last = pixel;
+        lastIndex = vals[slot];
+      }
+      out[x] = lastIndex;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Bin comparators per channel.
+ */
+
+#define COMPARE(c) \
+  static int \
+  compare##c(const void *a, const void *b) { \
+    return (int) ((((bin_t *) a)->key >> shift[c]) & 31) \
+      - (int) ((((bin_t *) b)->key >> shift[c]) & 31); \
+  }
+
+COMPARE(0)
+COMPARE(1)
+COMPARE(2)
+COMPARE(3)
+
+static int (*compare[4])(const void *, const void *) = {
+    compare0
+  , compare1
+  , compare2
+  , compare3
+};
+
+/*
+ * Compute the channel bounds of `box`.
+ */
+
+static void
+bounds(box_t *box, bin_t *bins) {
+  for (int c = 0; c < 4; ++c) box->min[c] = 31, box->max[c] = 0;
+  for (int i = box->start; i < box->end; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      uint8_t v = (bins[i].key >> shift[c]) & 31;
+      if (v < box->min[c]) box->min[c] = v;
+      if (v > box->max[c]) box->max[c] = v;
+    }
+  }
+}
+
+/*
+ * Widest channel of `box`, storing its range in `range`.
+ */
+
+static int
+widest(box_t *box, int *range) {
+  int best = 0;
+  *range = -1;
+  for (int c = 0; c < 4; ++c) {
+    int r = box->max[c] - box->min[c];
+    if (r > *range) *range = r, best = c;
+  }
+  return best;
+}
+
+/*
+ * Median cut the bins into at most PALETTE_MAX boxes.
+ *
+ * The box with the widest channel is always split next,
+ * bounding the per-channel error of every entry by the
+ * largest remaining box rather than its population.
+ */
+
+static int
+medianCut(bin_t *bins, int nbins, box_t *boxes) {
+  int nboxes = 1;
+  boxes[0].start = 0;
+  boxes[0].end = nbins;
+  bounds(&boxes[0], bins);
+
+  while (nboxes < PALETTE_MAX) {
+    int pick = -1, pickRange = 0;
+    for (int i = 0; i < nboxes; ++i) {
+      int range;
+      if (boxes[i].end - boxes[i].start < 2) continue;
+      widest(&boxes[i], &range);
+      if (range > pickRange) pick = i, pickRange = range;
+    }
+    if (pick < 0) break;
+
+    box_t *box = &boxes[pick];
+    int range, c = widest(box, &range);
+    qsort(bins + box->start, box->end - box->start, sizeof(bin_t), compare[c]);
+
+    // Weighted median
+    uint64_t total = 0, sum = 0;
+    for (int i = box->start; i < box->end; ++i) total += bins[i].count;
+    int split = box->start + 1;
+    for (int i = box->start; i < box->end - 1; ++i) {
+      sum += bins[i].count;
+      split = i + 1;
+      if (sum * 2 >= total) break;
+    }
+
+    box_t *other = &boxes[nboxes++];
+    other->start = split;
+    other->end = box->end;
+    box->end = split;
+    bounds(box, bins);
+    bounds(other, bins);
+  }
+
+  return nboxes;
+}
+
+/*
+ * Index of the palette entry nearest to `rgba`.
+ */
+
+static int
+nearest(palette_t *palette, const int *rgba) {
+  int best = 0;
+  unsigned bestDist = ~0u;
+  for (int i = 0; i < palette->count; ++i) {
+    uint8_t *color = palette->colors[i];
+    unsigned dist = 0;
+    for (int c = 0; c < 4; ++c) {
+      int d = rgba[c] - color[c];
+      dist += d * d;
+    }
+    if (dist < bestDist) {
+      best = i, bestDist = dist;
+      if (0 == dist) break;
+    }
+  }
+  return best;
+}
+
+/*
+ * Reduce the surface to PALETTE_MAX colors with median cut
+ * over a 5-bit per channel histogram, optionally applying
+ * Floyd-Steinberg dithering when mapping pixels.
+ */
+
+static cairo_status_t
+quantize(uint8_t *data, int width, int height, int stride, int dither, palette_t *palette) {
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  uint32_t *hist = (uint32_t *) calloc(HIST_SIZE, sizeof(uint32_t));
+  bin_t *bins = NULL;
+  box_t *boxes = NULL;
+  int *err = NULL;
+  int nbins = 0, nboxes;
+
+  if (!hist) return CAIRO_STATUS_NO_MEMORY;
+
+  // Histogram
+  for (int y = 0; y < height; ++y) {
+    uint32_t *row = (uint32_t *)(data + stride * y);
+    for (int x = 0; x < width; ++x) {
+      uint8_t px[4];
+      unpremultiply(row[x], px);
+      int rgba[4] = { px[0], px[1], px[2], px[3] };
+      if (!hist[binKey(rgba)]++) ++nbins;
+    }
+  }
+
+  bins = (bin_t *) malloc(nbins * sizeof(bin_t));
+  boxes = (box_t *) malloc(PALETTE_MAX * sizeof(box_t));
+  if (!bins || !boxes) {
+    status = CAIRO_STATUS_NO_MEMORY;
+    goto done;
+  }
+
+  nbins = 0;
+  for (uint32_t key = 0; key < HIST_SIZE; ++key) {
+    if (!hist[key]) continue;
+    bins[nbins].key = key;
+    bins[nbins++].count = hist[key];
+  }
+
+  // Palette from the weighted mean of each box
+  nboxes = medianCut(bins, nbins, boxes);
+  for (int i = 0; i < nboxes; ++i) {
+    uint64_t total = 0, sum[4] = { 0, 0, 0, 0 };
+    for (int j = boxes[i].start; j < boxes[i].end; ++j) {
+      total += bins[j].count;
+      for (int c = 0; c < 4; ++c)
+        sum[c] += (uint64_t) binValue(bins[j].key, c) * bins[j].count;
+    }
+    for (int c = 0; c < 4; ++c)
+      palette->colors[i][c] = (sum[c] + total / 2) / total;
+  }
+  palette->count = nboxes;
+
+  // Reuse the histogram as a bin -> index + 1 cache
+  memset(hist, 0, HIST_SIZE * sizeof(uint32_t));
+
+  if (dither) {
+    // Two rows of error, padded by a pixel either side, in 16ths
+    if (!(err = (int *) calloc((width + 2) * 8, sizeof(int)))) {
+      status = CAIRO_STATUS_NO_MEMORY;
+      goto done;
+    }
+  }
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *row = (uint32_t *)(data + stride * y);
+    uint8_t *out = palette->indices + width * y;
+    int *cur = err + ((y & 1) ? (width + 2) * 4 : 0) + 4
+      , *next = err + ((y & 1) ? 0 : (width + 2) * 4) + 4;
+
+    if (dither) memset(next - 4, 0, (width + 2) * 4 * sizeof(int));
+
+    for (int x = 0; x < width; ++x) {
+      uint8_t px[4];
+      int rgba[4];
+      unpremultiply(row[x], px);
+
+      // Leave fully transparent pixels undithered
+      int diffuse = dither && px[3];
+      for (int c = 0; c < 4; ++c) {
+        int v = px[c];
+        if (diffuse) {
+          v += (cur[x * 4 + c] + 8) >> 4;
+          v = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+        rgba[c] = v;
+      }
+
+      uint32_t key = binKey(rgba);
+      if (!hist[key]) {
+        int center[4];
+        for (int c = 0; c < 4; ++c) center[c] = binValue(key, c);
+        hist[key] = nearest(palette, center) + 1;
+      }
+      int index = hist[key] - 1;
+      out[x] = index;
+
+      if (diffuse) {
+        uint8_t *color = palette->colors[index];
+        for (int c = 0; c < 4; ++c) {
+          int e = rgba[c] - color[c];
+          cur[(x + 1) * 4 + c] += e * 7;
+          next[(x - 1) * 4 + c] += e * 3;
+          next[x * 4 + c] += e * 5;
+          next[(x + 1) * 4 + c] += e;
+        }
+      }
+    }
+  }
+
+done:
+  free(hist);
+  free(bins);
+  free(boxes);
+  free(err);
+  return status;
+}
+
+/*
+ * Index the ARGB32 `data` into `palette`.
+ *
+ * Surfaces with PALETTE_MAX colors or fewer are indexed
+ * exactly in a single pass, otherwise the colors are
+ * quantized, with optional dithering.
+ */
+
+cairo_status_t
+palette_quantize(
+    uint8_t *data
+  , int width
+  , int height
+  , int stride
+  , int dither
+  , palette_t *palette) {
+  size_t len = (size_t) width * height;
+  palette->count = 0;
+  palette->exact = 0;
+  if (!(palette->indices = (uint8_t *) malloc(len ? len : 1)))
+    return CAIRO_STATUS_NO_MEMORY;
+
+  if (exact(data, width, height, stride, palette)) {
+    palette->exact = 1;
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  cairo_status_t status = quantize(data, width, height, stride, dither, palette);
+  if (status) palette_free(palette);
+  return status;
+}
+
+/*
+ * Free the indices of `palette`.
+ */
+
+void
+palette_free(palette_t *palette) {
+  free(palette->indices);
+  palette->indices = NULL;
+}
@@ -0,0 +1,49 @@
+//
+// quantize.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_QUANTIZE_H__
+#define __NODE_QUANTIZE_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Max palette entries.
+ */
+
+#define PALETTE_MAX 256
+
+/*
+ * Indexed image produced from an ARGB32 surface.
+ *
+ * `colors` holds unpremultiplied RGBA entries, `indices`
+ * one byte per pixel, `width` bytes per row.
+ */
+
+typedef struct {
+  uint8_t colors[PALETTE_MAX][4];
+  int count;
+  int exact;
+  uint8_t *indices;
+} palette_t;
+
+/*
+ * Prototypes.
+ */
+
+cairo_status_t
+palette_quantize(
+    uint8_t *data
+  , int width
+  , int height
+  , int stride
+  , int dither
+  , palette_t *palette);
+
+void
+palette_free(palette_t *palette);
+
+#endif /* __NODE_QUANTIZE_H__ */
@@ -0,0 +1,134 @@
+//
+// rawencoder.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "rawencoder.h"
+#include "premultiply.h"
+#include "format.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Initialize default options.
+ */
+
+void
+canvas_raw_options_init(canvas_raw_options_t *opts) {
+  opts->layout = CANVAS_RAW_RGBA;
+}
+
+/*
+ * Parse layout `name`, returning 0 when unsupported.
+ */
+
+int
+canvas_raw_layout_parse(const char *name, canvas_raw_layout_t *layout) {
+  if (0 == strcmp("rgba", name)) *layout = CANVAS_RAW_RGBA;
+  else if (0 == strcmp("bgra", name)) *layout = CANVAS_RAW_BGRA;
+  else if (0 == strcmp("argb", name)) *layout = CANVAS_RAW_ARGB;
+  else return 0;
+  return 1;
+}
+
+/*
+ * Check if ARGB32 pixels are laid out as BGRA in memory.
+ */
+
+static inline int
+isLittleEndian() {
+  uint32_t pixel = 1;
+  return *(uint8_t *) &pixel;
+}
+
+/*
+ * Write `width` premultiplied pixels as BGRA or ARGB bytes.
+ */
+
+static void
+packRow(canvas_raw_layout_t layout, const uint32_t *src, uint8_t *dst, int width) {
+  if (CANVAS_RAW_BGRA == layout) {
+    for (int x = 0; x < width; ++x) {
+      uint32_t pixel = src[x];
+      *dst++ = pixel;
+      *dst++ = pixel >> 8;
+      *dst++ = pixel >> 16;
+      *dst++ = pixel >> 24;
+    }
+  } else {
+    for (int x = 0; x < width; ++x) {
+      uint32_t pixel = src[x];
+      *dst++ = pixel >> 24;
+      *dst++ = pixel >> 16;
+      *dst++ = pixel >> 8;
+      *dst++ = pixel;
+    }
+  }
+}
+
+/*
+ * Write the pixels of `surface` as tightly packed 4 byte
+ * rows in the layout selected by `opts`. Surfaces in other
+ * formats are expanded to ARGB32 a row at a time.
+ */
+
+cairo_status_t
+canvas_raw_write(
+    cairo_surface_t *surface
+  , canvas_raw_options_t *opts
+  , cairo_write_func_t write
+  , void *closure) {
+
+  cairo_format_t format = cairo_image_surface_get_format(surface);
+  switch (format) {
+    case CAIRO_FORMAT_ARGB32:
+    case CAIRO_FORMAT_RGB24:
+    case CAIRO_FORMAT_A8:
+    case CAIRO_FORMAT_RGB16_565:
+      break;
+    default:
+      return CAIRO_STATUS_INVALID_FORMAT;
+  }
+
+  cairo_surface_flush(surface);
+  uint8_t *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface)
+    , width = cairo_image_surface_get_width(surface)
+    , height = cairo_image_surface_get_height(surface);
+
+  if (!width || !height) return CAIRO_STATUS_INVALID_SIZE;
+
+  // Native rows go straight through
+  unsigned len = width * 4;
+  int argb = CAIRO_FORMAT_ARGB32 == format;
+  if (argb && CANVAS_RAW_BGRA == opts->layout && isLittleEndian()) {
+    for (int y = 0; y < height; ++y) {
+      cairo_status_t status = write(closure, data + y * stride, len);
+      if (status) return status;
+    }
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  uint8_t *row = (uint8_t *) malloc(argb ? len : len * 2);
+  if (!row) return CAIRO_STATUS_NO_MEMORY;
+  uint32_t *pixels = argb ? NULL : (uint32_t *) (row + len);
+
+  cairo_status_t status = CAIRO_STATUS_SUCCESS;
+  for (int y = 0; y < height && !status; ++y) {
+    uint32_t *src = (uint32_t *) (data + y * stride);
+    if (!argb) {
+      canvas_format_to_argb32(format, (uint8_t *) src, pixels, width);
+      src = pixels;
+    }
+    if (CANVAS_RAW_RGBA == opts->layout) {
+      canvas_unpremultiply(src, row, width);
+    } else {
+      packRow(opts->layout, src, row, width);
+    }
+    status = write(closure, row, len);
+  }
+
+  free(row);
+  return status;
+}
@@ -0,0 +1,49 @@
+//
+// rawencoder.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_RAW_ENCODER_H__
+#define __NODE_RAW_ENCODER_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Byte orders for raw output. RGBA is unpremultiplied like
+ * ImageData, BGRA and ARGB keep cairo's premultiplied alpha.
+ */
+
+typedef enum {
+    CANVAS_RAW_RGBA
+  , CANVAS_RAW_BGRA
+  , CANVAS_RAW_ARGB
+} canvas_raw_layout_t;
+
+/*
+ * Encoder options.
+ */
+
+typedef struct {
+  canvas_raw_layout_t layout;
+} canvas_raw_options_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+canvas_raw_options_init(canvas_raw_options_t *opts);
+
+int
+canvas_raw_layout_parse(const char *name, canvas_raw_layout_t *layout);
+
+cairo_status_t
+canvas_raw_write(
+    cairo_surface_t *surface
+  , canvas_raw_options_t *opts
+  , cairo_write_func_t write
+  , void *closure);
+
+#endif /* __NODE_RAW_ENCODER_H__ */
@@ -0,0 +1,142 @@
+//
+// shadowcache.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "shadowcache.h"
+#include <stdlib.h>
+
+/*
+ * Cache entry, most recently used first.
+ */
+
+typedef struct entry {
+  shadow_cache_key_t key;
+  cairo_surface_t *mask;
+  unsigned len;
+  struct entry *prev;
+  struct entry *next;
+} entry_t;
+
+/*
+ * LRU list and totals. Only accessed from the
+ * loop thread, so no locking is required.
+ */
+
+static entry_t *head = NULL;
+static entry_t *tail = NULL;
+static unsigned entries = 0;
+static unsigned long bytes = 0;
+
+/*
+ * Check if keys `a` and `b` are equal.
+ */
+
+static int
+equal(shadow_cache_key_t *a, shadow_cache_key_t *b) {
+  return a->hash == b->hash
+    && a->width == b->width
+    && a->height == b->height
+    && a->radius == b->radius;
+}
+
+/*
+ * Detach `e`.
+ */
+
+static void
+detach(entry_t *e) {
+  if (e->prev) e->prev->next = e->next;
+  else head = e->next;
+  if (e->next) e->next->prev = e->prev;
+  else tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+/*
+ * Attach `e` as most recently used.
+ */
+
+static void
+attach(entry_t *e) {
+  e->prev = NULL;
+  e->next = head;
+  if (head) head->prev = e;
+  head = e;
+  if (!tail) tail = e;
+}
+
+/*
+ * Detach and free `e`.
+ */
+
+static void
+evict(entry_t *e) {
+  detach(e);
+  --entries;
+  bytes -= e->len;
+  cairo_surface_destroy(e->mask);
+  free(e);
+}
+
+/*
+ * Find the entry for `key`.
+ */
+
+static entry_t *
+find(shadow_cache_key_t *key) {
+  for (entry_t *e = head; e; e = e->next)
+    if (equal(&e->key, key)) return e;
+  return NULL;
+}
+
+/*
+ * Look up the blurred mask for `key`, returning a new
+ * reference or NULL.
+ */
+
+cairo_surface_t *
+shadow_cache_get(shadow_cache_key_t *key) {
+  entry_t *e = find(key);
+  if (!e) return NULL;
+  detach(e);
+  attach(e);
+  return cairo_surface_reference(e->mask);
+}
+
+/*
+ * Retain a reference to `mask` for `key`, evicting least
+ * recently used entries. Masks over a quarter of the budget
+ * are not retained.
+ */
+
+void
+shadow_cache_put(shadow_cache_key_t *key, cairo_surface_t *mask) {
+  entry_t *e;
+  unsigned len = cairo_image_surface_get_stride(mask)
+    * cairo_image_surface_get_height(mask);
+  if (len > SHADOW_CACHE_MAX_BYTES / 4) return;
+  if (find(key)) return;
+  if (!(e = (entry_t *) malloc(sizeof(entry_t)))) return;
+
+  e->key = *key;
+  e->mask = cairo_surface_reference(mask);
+  e->len = len;
+
+  while (tail && (entries >= SHADOW_CACHE_MAX_ENTRIES
+    || bytes + len > SHADOW_CACHE_MAX_BYTES)) evict(tail);
+
+  attach(e);
+  ++entries;
+  bytes += len;
+}
+
+/*
+ * Free all entries.
+ */
+
+void
+shadow_cache_clear() {
+  while (tail) evict(tail);
+}
@@ -0,0 +1,55 @@
+//
+// shadowcache.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_SHADOW_CACHE_H__
+#define __NODE_SHADOW_CACHE_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Max bytes of shadow masks retained.
+ */
+
+#ifndef SHADOW_CACHE_MAX_BYTES
+#define SHADOW_CACHE_MAX_BYTES (8 * 1024 * 1024)
+#endif
+
+/*
+ * Max entries retained.
+ */
+
+#ifndef SHADOW_CACHE_MAX_ENTRIES
+#define SHADOW_CACHE_MAX_ENTRIES 64
+#endif
+
+/*
+ * Cache key, the hash of the shape's device-space geometry
+ * relative to the mask origin and its drawing parameters,
+ * plus the mask dimensions and blur radius.
+ */
+
+typedef struct {
+  uint64_t hash;
+  int width;
+  int height;
+  int radius;
+} shadow_cache_key_t;
+
+/*
+ * Prototypes.
+ */
+
+cairo_surface_t *
+shadow_cache_get(shadow_cache_key_t *key);
+
+void
+shadow_cache_put(shadow_cache_key_t *key, cairo_surface_t *mask);
+
+void
+shadow_cache_clear();
+
+#endif /* __NODE_SHADOW_CACHE_H__ */
@@ -0,0 +1,175 @@
+//
+// surfacepool.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "surfacepool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Smallest size class, as a power of two.
+ */
+
+#define MIN_SHIFT 12
+#define MIN_SIZE (1 << MIN_SHIFT)
+
+/*
+ * Largest pooled size class, as a power of two.
+ */
+
+#define MAX_SHIFT 31
+
+/*
+ * Four classes per doubling, wasting at most 25%.
+ */
+
+#define CLASSES ((MAX_SHIFT - MIN_SHIFT) * 4 + 1)
+
+/*
+ * Retained block. Only `dirtyStart` to `dirtyEnd`
+ * may be non-zero, and is cleared on reuse.
+ */
+
+typedef struct {
+  uint8_t *data;
+  size_t capacity;
+  size_t dirtyStart;
+  size_t dirtyEnd;
+} block_t;
+
+/*
+ * Free lists per class. Canvases are created and
+ * destroyed on the loop thread, so no locking is required.
+ */
+
+static block_t pool[CLASSES][SURFACE_POOL_CLASS_SLOTS];
+static unsigned counts[CLASSES];
+static surface_pool_stats_t stats = {
+    0, 0, 0, 0
+  , SURFACE_POOL_MAX_BYTES
+  , SURFACE_POOL_MAX_PER_CLASS
+};
+
+/*
+ * Size class for `len` bytes, storing its capacity
+ * in `capacity`. Returns -1 when too large to pool,
+ * the largest class holding 2^MAX_SHIFT bytes.
+ */
+
+static int
+sizeClass(size_t len, size_t *capacity) {
+  if (len <= MIN_SIZE) {
+    *capacity = MIN_SIZE;
+    return 0;
+  }
+
+  int shift = MIN_SHIFT;
+  while (shift < MAX_SHIFT && ((size_t) 1 << (shift + 1)) < len) ++shift;
+  if (((size_t) 1 << (shift + 1)) < len) return -1;
+
+  size_t base = (size_t) 1 << shift
+    , step = base >> 2
+    , n = (len - base + step - 1) / step;
+  int i = (shift - MIN_SHIFT) * 4 + n;
+  if (i >= CLASSES) return -1;
+  *capacity = base + n * step;
+  assert(*capacity >= len);
+  return i;
+}
+
+/*
+ * Drop retained blocks until within the limits.
+ */
+
+static void
+trim() {
+  for (int i = CLASSES - 1; i >= 0; --i) {
+    while (counts[i] && (counts[i] > stats.maxPerClass || stats.bytes > stats.maxBytes)) {
+      block_t *block = &pool[i][--counts[i]];
+      free(block->data);
+      stats.bytes -= block->capacity;
+      --stats.blocks;
+    }
+  }
+}
+
+/*
+ * Acquire a zeroed block of at least `len` bytes, storing its
+ * capacity in `capacity` for surface_pool_release().
+ */
+
+uint8_t *
+surface_pool_acquire(size_t len, size_t *capacity) {
+  int i = sizeClass(len, capacity);
+
+  if (i < 0) {
+    *capacity = len;
+    ++stats.misses;
+    return (uint8_t *) calloc(len, 1);
+  }
+
+  if (counts[i]) {
+    block_t *block = &pool[i][--counts[i]];
+    memset(block->data + block->dirtyStart, 0, block->dirtyEnd - block->dirtyStart);
+    stats.bytes -= *capacity;
+    --stats.blocks;
+    ++stats.hits;
+    return block->data;
+  }
+
+  ++stats.misses;
+  return (uint8_t *) calloc(*capacity, 1);
+}
+
+/*
+ * Return a block for reuse. Only the bytes from `dirtyStart`
+ * to `dirtyEnd` may have been written, these are cleared lazily
+ * when the block is next acquired.
+ */
+
+void
+surface_pool_release(uint8_t *data, size_t capacity, size_t dirtyStart, size_t dirtyEnd) {
+  size_t classCapacity;
+  int i = sizeClass(capacity, &classCapacity);
+
+  if (i < 0
+    || classCapacity != capacity
+    || counts[i] >= stats.maxPerClass
+    || stats.bytes + capacity > stats.maxBytes) {
+    free(data);
+    return;
+  }
+
+  block_t *block = &pool[i][counts[i]++];
+  block->data = data;
+  block->capacity = capacity;
+  block->dirtyStart = dirtyStart < dirtyEnd ? dirtyStart : 0;
+  block->dirtyEnd = dirtyStart < dirtyEnd ? dirtyEnd : 0;
+  stats.bytes += capacity;
+  ++stats.blocks;
+}
+
+/*
+ * Set the retention limits, freeing blocks beyond them.
+ */
+
+void
+surface_pool_configure(unsigned long maxBytes, unsigned maxPerClass) {
+  stats.maxBytes = maxBytes;
+  stats.maxPerClass = maxPerClass > SURFACE_POOL_CLASS_SLOTS
+    ? SURFACE_POOL_CLASS_SLOTS
+    : maxPerClass;
+  trim();
+}
+
+/*
+ * Copy the counters and limits to `out`.
+ */
+
+void
+surface_pool_stats(surface_pool_stats_t *out) {
+  *out = stats;
+}
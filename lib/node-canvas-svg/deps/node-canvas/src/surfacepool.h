@@ -0,0 +1,64 @@
+//
+// surfacepool.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_SURFACE_POOL_H__
+#define __NODE_SURFACE_POOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Default bytes retained across all size classes.
+ */
+
+#ifndef SURFACE_POOL_MAX_BYTES
+#define SURFACE_POOL_MAX_BYTES (64 * 1024 * 1024)
+#endif
+
+/*
+ * Default blocks retained per size class.
+ */
+
+#ifndef SURFACE_POOL_MAX_PER_CLASS
+#define SURFACE_POOL_MAX_PER_CLASS 4
+#endif
+
+/*
+ * Upper bound for the per class limit.
+ */
+
+#define SURFACE_POOL_CLASS_SLOTS 16
+
+/*
+ * Pool counters and limits.
+ */
+
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long bytes;
+  unsigned blocks;
+  unsigned long maxBytes;
+  unsigned maxPerClass;
+} surface_pool_stats_t;
+
+/*
+ * Prototypes.
+ */
+
+uint8_t *
+surface_pool_acquire(size_t len, size_t *capacity);
+
+void
+surface_pool_release(uint8_t *data, size_t capacity, size_t dirtyStart, size_t dirtyEnd);
+
+void
+surface_pool_configure(unsigned long maxBytes, unsigned maxPerClass);
+
+void
+surface_pool_stats(surface_pool_stats_t *stats);
+
+#endif /* __NODE_SURFACE_POOL_H__ */
@@ -0,0 +1,226 @@
+//
+// tiles.cc
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#include "tiles.h"
+#include "format.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Work shared by the replay threads. Tiles are handed
+ * out in row-major order under `lock`, so threads finishing
+ * cheap tiles early pick up the remaining ones.
+ */
+
+typedef struct {
+  tiles_replay_t *replay;
+  cairo_format_t format;
+  uint8_t *data;
+  int stride;
+  int bpp;
+  int size;
+  int cols;
+  int count;
+  int next;
+  cairo_status_t status;
+  pthread_mutex_t lock;
+} tiles_work_t;
+
+/*
+ * Replay thread state. Cairo builds a recording's lookup
+ * structures lazily on replay and without locking, so no
+ * two threads may replay the same recording surface;
+ * each replays `source`, a copy of its own.
+ */
+
+typedef struct {
+  tiles_work_t *work;
+  cairo_surface_t *source;
+} tiles_thread_t;
+
+/*
+ * Initialize default options, a single thread.
+ */
+
+void
+tiles_options_init(tiles_options_t *opts) {
+  opts->size = TILES_DEFAULT_SIZE;
+  opts->threads = 1;
+}
+
+/*
+ * Replay `source` into the tile at `tx`, `ty` through a
+ * surface of its own over the shared target memory.
+ */
+
+static cairo_status_t
+replayTile(tiles_work_t *work, cairo_surface_t *source, int tx, int ty, int tw, int th) {
+  tiles_replay_t *replay = work->replay;
+  cairo_surface_t *surface = cairo_image_surface_create_for_data(
+      work->data + ty * work->stride + tx * work->bpp
+    , work->format
+    , tw
+    , th
+    , work->stride);
+
+  cairo_t *cr = cairo_create(surface);
+  cairo_translate(cr, -tx, -ty);
+
+  if (replay->clip) {
+    for (int i = 0; i < replay->clip->num_rectangles; ++i) {
+      cairo_rectangle_t *rect = &replay->clip->rectangles[i];
+      cairo_rectangle(cr, rect->x, rect->y, rect->width, rect->height);
+    }
+    cairo_clip(cr);
+  }
+
+  cairo_transform(cr, &replay->matrix);
+  cairo_rectangle(cr, 0, 0, replay->width, replay->height);
+  cairo_clip(cr);
+  cairo_set_source_surface(cr, source, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), replay->filter);
+  cairo_set_operator(cr, replay->op);
+  cairo_paint_with_alpha(cr, replay->alpha);
+
+  cairo_status_t status = cairo_status(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+  return status;
+}
+
+/*
+ * Replay thread, looping until the tiles run out.
+ */
+
+static void *
+replayTiles(void *data) {
+  tiles_thread_t *thread = (tiles_thread_t *) data;
+  tiles_work_t *work = thread->work;
+  tiles_replay_t *replay = work->replay;
+
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    int i = work->next++;
+    int failed = work->status;
+    pthread_mutex_unlock(&work->lock);
+    if (i >= work->count || failed) break;
+
+    int tx = replay->x + (i % work->cols) * work->size
+      , ty = replay->y + (i / work->cols) * work->size
+      , tw = replay->x + replay->w - tx
+      , th = replay->y + replay->h - ty;
+    if (tw > work->size) tw = work->size;
+    if (th > work->size) th = work->size;
+
+    cairo_status_t status = replayTile(work, thread->source, tx, ty, tw, th);
+    if (status) {
+      pthread_mutex_lock(&work->lock);
+      if (!work->status) work->status = status;
+      pthread_mutex_unlock(&work->lock);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Copy the recording `source` by painting it into a new
+ * recording surface, which records a snapshot of it. Cairo
+ * hands out a cached snapshot until the surface is flushed,
+ * so flush first for every copy to get a snapshot of its own.
+ * The copy may then be replayed on another thread while the
+ * source is replayed here. NULL on failure.
+ */
+
+cairo_surface_t *
+tiles_copy_recording(cairo_surface_t *source, double width, double height) {
+  cairo_surface_flush(source);
+  cairo_rectangle_t extents = { 0, 0, width, height };
+  cairo_surface_t *copy = cairo_recording_surface_create(
+      cairo_surface_get_content(source)
+    , &extents);
+  cairo_t *cr = cairo_create(copy);
+  cairo_set_source_surface(cr, source, 0, 0);
+  cairo_paint(cr);
+  cairo_status_t status = cairo_status(cr);
+  cairo_destroy(cr);
+  if (status || cairo_surface_status(copy)) {
+    cairo_surface_destroy(copy);
+    return NULL;
+  }
+  return copy;
+}
+
+/*
+ * Replay `replay` onto the image surface `target`,
+ * splitting the region into `opts->size` tiles rendered
+ * concurrently by up to `opts->threads` threads, the
+ * calling thread included. Each tile has its own cairo_t.
+ *
+ * Recordings may not be replayed from several threads at
+ * once, so every extra thread first gets a copy of the
+ * recording made here on the calling thread, costing a
+ * serial replay and the recording's memory per thread.
+ * The calling thread replays `replay->source` itself.
+ */
+
+cairo_status_t
+tiles_replay(cairo_surface_t *target, tiles_replay_t *replay, tiles_options_t *opts) {
+  if (replay->w <= 0 || replay->h <= 0) return CAIRO_STATUS_SUCCESS;
+
+  // Keep tile origins word aligned for every format
+  replay->w += replay->x & 3;
+  replay->x &= ~3;
+
+  tiles_work_t work;
+  work.replay = replay;
+  work.size = opts->size < TILES_MIN_SIZE ? TILES_MIN_SIZE : (opts->size + 3) & ~3;
+  work.cols = (replay->w + work.size - 1) / work.size;
+  work.count = work.cols * ((replay->h + work.size - 1) / work.size);
+  work.next = 0;
+  work.status = CAIRO_STATUS_SUCCESS;
+
+  int threads = opts->threads;
+  if (threads > TILES_MAX_THREADS) threads = TILES_MAX_THREADS;
+  if (threads > work.count) threads = work.count;
+  if (threads < 1) threads = 1;
+
+  cairo_surface_flush(target);
+  work.format = cairo_image_surface_get_format(target);
+  work.bpp = canvas_format_bpp(work.format);
+  work.data = cairo_image_surface_get_data(target);
+  work.stride = cairo_image_surface_get_stride(target);
+  pthread_mutex_init(&work.lock, NULL);
+
+  tiles_thread_t state[TILES_MAX_THREADS];
+  pthread_t tids[TILES_MAX_THREADS];
+  int copies = 0, started = 0;
+
+  // Copies are made before any thread replays
+  state[0].work = &work;
+  state[0].source = replay->source;
+  while (copies < threads - 1) {
+    cairo_surface_t *copy = tiles_copy_recording(replay->source, replay->width, replay->height);
+    if (!copy) break;
+    state[++copies].work = &work;
+    state[copies].source = copy;
+  }
+
+  while (started < copies
+    && !pthread_create(&tids[started], NULL, replayTiles, &state[started + 1]))
+    ++started;
+
+  replayTiles(&state[0]);
+  for (int i = 0; i < started; ++i)
+    pthread_join(tids[i], NULL);
+  for (int i = 1; i <= copies; ++i)
+    cairo_surface_destroy(state[i].source);
+
+  pthread_mutex_destroy(&work.lock);
+  cairo_surface_mark_dirty_rectangle(target, replay->x, replay->y, replay->w, replay->h);
+  return work.status;
+}
@@ -0,0 +1,74 @@
+//
+// tiles.h
+//
+// Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+//
+
+#ifndef __NODE_TILES_H__
+#define __NODE_TILES_H__
+
+#include <cairo.h>
+
+/*
+ * Default tile edge in pixels.
+ */
+
+#ifndef TILES_DEFAULT_SIZE
+#define TILES_DEFAULT_SIZE 256
+#endif
+
+/*
+ * Smallest tile edge, smaller tiles cost more in per-tile
+ * setup than they gain in parallelism.
+ */
+
+#define TILES_MIN_SIZE 16
+
+/*
+ * Max replay threads.
+ */
+
+#define TILES_MAX_THREADS 64
+
+/*
+ * Tiled replay options.
+ */
+
+typedef struct {
+  int size;
+  int threads;
+} tiles_options_t;
+
+/*
+ * Replay of `source`, a recording surface of `width` by
+ * `height`, through `matrix` onto the device-space region
+ * `x`, `y`, `w`, `h` of an image surface. `clip` holds
+ * device-space clip rectangles, or is NULL when unclipped.
+ */
+
+typedef struct {
+  cairo_surface_t *source;
+  double width;
+  double height;
+  cairo_matrix_t matrix;
+  cairo_operator_t op;
+  cairo_filter_t filter;
+  double alpha;
+  cairo_rectangle_list_t *clip;
+  int x, y, w, h;
+} tiles_replay_t;
+
+/*
+ * Prototypes.
+ */
+
+void
+tiles_options_init(tiles_options_t *opts);
+
+cairo_status_t
+tiles_replay(cairo_surface_t *target, tiles_replay_t *replay, tiles_options_t *opts);
+
+cairo_surface_t *
+tiles_copy_recording(cairo_surface_t *source, double width, double height);
+
+#endif /* __NODE_TILES_H__ */
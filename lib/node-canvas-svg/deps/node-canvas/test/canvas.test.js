@@ -149,6 +149,38 @@ module.exports = {
 
     ctx.fillStyle = 'rgba( 255, 200, 90, .7555)';
     assert.equal('rgba(255, 200, 90, 0.75)', ctx.fillStyle);
+
+    ctx.fillStyle = '#ff000080';
+    assert.equal('rgba(255, 0, 0, 0.50)', ctx.fillStyle);
+
+    ctx.fillStyle = 'rgb(100%, 50%, 0%)';
+    assert.equal('#ff8000', ctx.fillStyle);
+
+    ctx.fillStyle = 'rgba(0, 0, 0)';
+    assert.equal('#000000', ctx.fillStyle);
+
+    ctx.fillStyle = 'rgb(3000000, 0, 0)';
+    assert.equal('#ff0000', ctx.fillStyle);
+
+    ctx.fillStyle = 'rgba(0, 0, 0, 5000000)';
+    assert.equal('#000000', ctx.fillStyle);
+
+    ctx.fillStyle = 'hsl(120, 100%, 25%)';
+    assert.equal('#008000', ctx.fillStyle);
+
+    ctx.fillStyle = 'hsla(240deg, 100%, 50%, 0.5)';
+    assert.equal('rgba(0, 0, 255, 0.50)', ctx.fillStyle);
+
+    ctx.fillStyle = 'indianred';
+    assert.equal('#cd5c5c', ctx.fillStyle);
+
+    ctx.fillStyle = 'Indigo';
+    assert.equal('#4b0082', ctx.fillStyle);
+
+    ctx.fillStyle = 'yellowgreen';
+    ctx.fillStyle = 'yellowgreens';
+    ctx.fillStyle = 'rgb(1, 2)';
+    assert.equal('#9acd32', ctx.fillStyle);
   },
   
   'test Canvas#getContext("2d")': function(assert){
@@ -303,6 +335,610 @@ module.exports = {
     });
   },
   
+  'test Canvas.renderBatch()': function(assert, beforeExit){
+    var a = new Canvas(20, 20)
+      , b = new Canvas(30, 10)
+      , recording = new Canvas(10, 10, 'recording')
+      , calls = 0;
+
+    a.getContext('2d').fillRect(0,0,10,10);
+    recording.getContext('2d').fillRect(0,0,5,5);
+
+    Canvas.renderBatch([a, b, recording], function(err, buffers){
+      ++calls;
+      assert.ok(!err);
+      assert.equal(3, buffers.length);
+      assert.equal(a.toBuffer().toString('base64'), buffers[0].toString('base64'));
+      assert.equal(b.toBuffer().toString('base64'), buffers[1].toString('base64'));
+      assert.equal('PNG', buffers[2].slice(1,4).toString());
+    });
+
+    // The same recording in several jobs, with shared options
+    var same = [];
+    for (var i = 0; i < 8; ++i) same.push(recording);
+    Canvas.renderBatch(same, { filters: 0 }, function(err, buffers){
+      ++calls;
+      assert.ok(!err);
+      buffers.forEach(function(buf){
+        assert.equal(buffers[0].toString('base64'), buf.toString('base64'));
+      });
+    });
+
+    Canvas.renderBatch([], function(err, buffers){
+      ++calls;
+      assert.ok(!err);
+      assert.equal(0, buffers.length);
+    });
+
+    var err;
+    try { Canvas.renderBatch([a, {}], function(){}); } catch (e) { err = e; }
+    assert.ok(err instanceof TypeError);
+
+    beforeExit(function(){
+      assert.equal(3, calls);
+    });
+  },
+  
+  'test Canvas#toBuffer(buffer)': function(assert){
+    var canvas = new Canvas(200,200)
+      , out = new Buffer(64 * 1024)
+      , buf = canvas.toBuffer(out);
+    assert.equal('PNG', buf.slice(1,4).toString());
+    assert.equal(canvas.toBuffer().length, buf.length);
+    assert.equal('PNG', out.slice(1,4).toString());
+
+    var err;
+    try {
+      canvas.toBuffer(new Buffer(8));
+    } catch (e) {
+      err = e;
+    }
+    assert.ok(err instanceof Error, 'did not throw on a short buffer');
+  },
+  
+  'test Canvas#toBuffer(buffer) async': function(assert){
+    var out = new Buffer(64 * 1024);
+    new Canvas(200, 200).toBuffer(out, function(err, buf){
+      assert.ok(!err);
+      assert.equal('PNG', buf.slice(1,4).toString());
+      assert.equal('PNG', out.slice(1,4).toString());
+    });
+  },
+  
+  'test Canvas#toBuffer(options)': function(assert){
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'rgba(255,0,0,0.5)';
+    ctx.fillRect(0,0,100,100);
+
+    [ { compressionLevel: 0 }
+    , { compressionLevel: 9, filters: Canvas.PNG_FILTER_PAETH }
+    , { filters: Canvas.PNG_FILTER_NONE | Canvas.PNG_FILTER_SUB }
+    , { backend: 'zlib' }
+    , { backend: 'cairo' }
+    ].forEach(function(options){
+      var buf = canvas.toBuffer(options);
+      assert.equal('PNG', buf.slice(1,4).toString(), sys.inspect(options));
+    });
+
+    assert.ok(canvas.toBuffer({ compressionLevel: 0 }).length
+      > canvas.toBuffer({ compressionLevel: 9 }).length);
+
+    var err;
+    try {
+      canvas.toBuffer({ backend: 'invalid' });
+    } catch (e) {
+      err = e;
+    }
+    assert.equal('invalid backend', err.message);
+  },
+  
+  'test Canvas#generation': function(assert){
+    var canvas = new Canvas(20, 20)
+      , ctx = canvas.getContext('2d')
+      , gen = canvas.generation;
+
+    ctx.fillRect(0,0,10,10);
+    assert.ok(canvas.generation > gen);
+    gen = canvas.generation;
+    ctx.moveTo(0,0);
+    ctx.lineTo(10,10);
+    assert.equal(gen, canvas.generation);
+    ctx.stroke();
+    assert.ok(canvas.generation > gen);
+    gen = canvas.generation;
+    ctx.clearRect(0,0,5,5);
+    assert.ok(canvas.generation > gen);
+    gen = canvas.generation;
+    ctx.putImageData(ctx.getImageData(0,0,2,2), 5, 5);
+    assert.ok(canvas.generation > gen);
+  },
+  
+  'test Canvas#getDirtyRect()': function(assert){
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d');
+
+    assert.equal(null, canvas.getDirtyRect());
+
+    ctx.fillRect(10,10,50,20);
+    assert.eql({ x: 10, y: 10, width: 50, height: 20 }, canvas.getDirtyRect());
+
+    ctx.clearRect(80,80,50,50);
+    assert.eql({ x: 10, y: 10, width: 90, height: 90 }, canvas.getDirtyRect());
+
+    canvas.resetDirty();
+    assert.equal(null, canvas.getDirtyRect());
+
+    var gen = canvas.generation;
+    ctx.fillRect(200,200,10,10);
+    assert.equal(null, canvas.getDirtyRect());
+    assert.equal(gen, canvas.generation);
+
+    ctx.translate(5,5);
+    ctx.scale(2,2);
+    ctx.fillRect(0,0,10,10);
+    assert.eql({ x: 5, y: 5, width: 20, height: 20 }, canvas.getDirtyRect());
+
+    canvas.resetDirty();
+    ctx.putImageData(ctx.getImageData(0,0,4,4), 1, 2);
+    assert.eql({ x: 1, y: 2, width: 4, height: 4 }, canvas.getDirtyRect());
+
+    // Out of range and NaN extents
+    canvas.resetDirty();
+    canvas.markDirty(NaN, 0, 10, 10);
+    assert.equal(null, canvas.getDirtyRect());
+    canvas.markDirty(-1e20, 10, 1e40, 1e30);
+    assert.eql({ x: 0, y: 10, width: 100, height: 90 }, canvas.getDirtyRect());
+  },
+  
+  'test Canvas#width= same value': function(assert){
+    var canvas = new Canvas(20, 20)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillRect(5,5,10,10);
+    assert.equal(255, ctx.getImageData(6,6,1,1).data[3]);
+
+    canvas.width = 20;
+    assert.equal(20, canvas.width);
+    assert.equal(0, ctx.getImageData(6,6,1,1).data[3]);
+    assert.equal(null, canvas.getDirtyRect());
+  },
+  
+  'test Canvas#resetDirty() pooled reuse': function(assert){
+    var canvas = new Canvas(64, 64)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillRect(0,0,64,64);
+    canvas.resetDirty();
+    canvas.width = 64;
+    assert.equal(0, ctx.getImageData(10,10,1,1).data[3]);
+
+    ctx.fillRect(0,0,64,64);
+    canvas.resetDirty();
+    var hits = Canvas.poolStats().hits;
+    canvas.width = 32;
+    var reused = new Canvas(64, 64)
+      , data = reused.getContext('2d').getImageData(0,0,64,64).data;
+    assert.ok(Canvas.poolStats().hits > hits);
+    for (var i = 0, len = data.length; i < len; ++i) {
+      if (data[i]) assert.fail(data[i], 0, 'pixel ' + (i >> 2) + ' not cleared');
+    }
+  },
+  
+  'test Canvas.poolStats()': function(assert){
+    var stats = Canvas.poolStats()
+      , hits = stats.hits;
+
+    // Start from an empty pool
+    Canvas.configurePool({ maxBytes: 0 });
+    Canvas.configurePool({ maxBytes: stats.maxBytes });
+
+    var canvas = new Canvas(64, 64);
+    assert.ok(Canvas.poolStats().misses + Canvas.poolStats().hits > stats.misses + hits);
+
+    // Blocks of drawn canvases return to the pool
+    canvas.getContext('2d').fillRect(0,0,64,64);
+    canvas.width = 32;
+    assert.equal(1, Canvas.poolStats().blocks);
+    hits = Canvas.poolStats().hits;
+    canvas.width = 64;
+    assert.equal(hits + 1, Canvas.poolStats().hits);
+    assert.equal(0, canvas.getContext('2d').getImageData(10,10,1,1).data[3]);
+
+    // Blocks viewed by raw buffers are freed instead
+    var raw = canvas.getRawBuffer();
+    assert.equal(1, Canvas.poolStats().blocks);
+    canvas.width = 32;
+    assert.equal(0, Canvas.poolStats().blocks);
+    assert.equal(64 * 64 * 4, raw.length);
+
+    Canvas.configurePool({ maxBytes: 0 });
+    assert.equal(0, Canvas.poolStats().bytes);
+    assert.equal(0, Canvas.poolStats().blocks);
+    Canvas.configurePool({ maxBytes: stats.maxBytes });
+    assert.equal(stats.maxBytes, Canvas.poolStats().maxBytes);
+  },
+  
+  'test Canvas formats': function(assert){
+    assert.equal('argb32', new Canvas(10, 10).format);
+
+    var rgb = new Canvas(10, 10, { format: 'rgb24' })
+      , ctx = rgb.getContext('2d');
+    assert.equal('rgb24', rgb.format);
+    ctx.fillStyle = 'rgba(255,0,0,0.5)';
+    ctx.fillRect(0,0,5,5);
+    var px = ctx.getImageData(2,2,1,1).data;
+    assert.ok(Math.abs(128 - px[0]) <= 1);
+    assert.equal(255, px[3]);
+    assert.eql([0,0,0,255], [].slice.call(ctx.getImageData(7,7,1,1).data));
+    assert.equal(2, rgb.toBuffer()[25]);
+
+    var mask = new Canvas(10, 10, { format: 'a8' });
+    mask.getContext('2d').fillRect(0,0,5,5);
+    assert.equal(255, mask.getContext('2d').getImageData(2,2,1,1).data[3]);
+    assert.equal(0, mask.toBuffer()[25]);
+
+    var rgb16 = new Canvas(10, 10, { format: 'rgb16_565' })
+      , ctx16 = rgb16.getContext('2d')
+      , data = ctx16.createImageData(1, 1);
+    data.data[0] = 255;
+    data.data[3] = 255;
+    ctx16.putImageData(data, 3, 3);
+    assert.eql([255,0,0,255], [].slice.call(ctx16.getImageData(3,3,1,1).data));
+    assert.equal('PNG', rgb16.toBuffer('png', { compressionLevel: 3 }).slice(1,4).toString());
+
+    var err;
+    try { new Canvas(10, 10, { format: 'cmyk' }); } catch (e) { err = e; }
+    assert.ok(err instanceof TypeError);
+  },
+  
+  'test Context2d#drawRecording()': function(assert){
+    var recording = new Canvas(10, 10, 'recording')
+      , rec = recording.getContext('2d');
+
+    assert.equal('recording', recording.type);
+    assert.equal('image', new Canvas(10, 10).type);
+
+    rec.fillStyle = '#f00';
+    rec.fillRect(0,0,5,5);
+
+    var canvas = new Canvas(40, 40)
+      , ctx = canvas.getContext('2d');
+    ctx.drawRecording(recording, 10, 10, 2);
+
+    var data = ctx.getImageData(0,0,40,40).data;
+    function alpha(x, y) { return data[(y * 40 + x) * 4 + 3]; }
+    assert.equal(0, alpha(5, 5));
+    assert.equal(255, alpha(10, 10));
+    assert.equal(255, alpha(19, 19));
+    assert.equal(0, alpha(21, 21));
+    assert.equal(255, data[(15 * 40 + 15) * 4]);
+    assert.eql({ x: 10, y: 10, width: 20, height: 20 }, canvas.getDirtyRect());
+
+    var err;
+    try { recording.toBuffer(); } catch (e) { err = e; }
+    assert.ok(err instanceof Error);
+
+    err = null;
+    try { ctx.drawRecording(canvas); } catch (e) { err = e; }
+    assert.ok(err instanceof TypeError);
+  },
+  
+  'test Context2d#drawRecording() tiled': function(assert){
+    var recording = new Canvas(50, 50, 'recording')
+      , rec = recording.getContext('2d');
+
+    rec.fillStyle = '#0f0';
+    rec.arc(25, 25, 20, 0, Math.PI * 2);
+    rec.fill();
+
+    var a = new Canvas(120, 120)
+      , b = new Canvas(120, 120);
+    a.getContext('2d').drawRecording(recording, 5, 5, 2);
+    b.getContext('2d').drawRecording(recording, 5, 5, 2, { threads: 4, tileSize: 16 });
+
+    assert.equal(a.contentHash(), b.contentHash());
+    assert.eql(a.getDirtyRect(), b.getDirtyRect());
+  },
+  
+  'test Canvas#memoryStats()': function(assert){
+    var before = Canvas.memoryStats()
+      , canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d')
+      , grad = ctx.createLinearGradient(0,0,100,0);
+
+    grad.addColorStop(0, 'red');
+    grad.addColorStop(1, 'blue');
+    ctx.getImageData(0,0,10,10);
+
+    var stats = canvas.memoryStats();
+    assert.equal(before.canvas.objects + 1, stats.canvas.objects);
+    assert.ok(stats.canvas.bytes >= before.canvas.bytes + 100 * 100 * 4);
+    assert.equal(before.context2d.objects + 1, stats.context2d.objects);
+    assert.equal(before.gradient.objects + 1, stats.gradient.objects);
+    assert.ok(stats.gradient.bytes > before.gradient.bytes);
+    assert.equal(before.pixelArray.objects + 1, stats.pixelArray.objects);
+    assert.ok(stats.pixelArray.bytes >= before.pixelArray.bytes + 400);
+    assert.ok(stats.bytes > before.bytes);
+  },
+  
+  'test Canvas#contentHash()': function(assert){
+    var a = new Canvas(50, 50)
+      , b = new Canvas(50, 50);
+
+    assert.equal(16, a.contentHash().length);
+    assert.equal(a.contentHash(), b.contentHash());
+
+    a.getContext('2d').fillRect(0,0,10,10);
+    assert.notEqual(a.contentHash(), b.contentHash());
+
+    b.getContext('2d').fillRect(0,0,10,10);
+    assert.equal(a.contentHash(), b.contentHash());
+  },
+  
+  'test Canvas#toBuffer() cached': function(assert){
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'red';
+    ctx.fillRect(0,0,50,50);
+
+    var a = canvas.toBuffer()
+      , b = canvas.toBuffer();
+    assert.equal(a.toString('base64'), b.toString('base64'));
+
+    var c = canvas.toBuffer({ compressionLevel: 1 });
+    assert.equal('PNG', c.slice(1,4).toString());
+
+    ctx.fillRect(50,50,50,50);
+    assert.notEqual(a.toString('base64'), canvas.toBuffer().toString('base64'));
+  },
+  
+  'test Canvas#toBuffer() async cached': function(assert){
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'blue';
+    ctx.fillRect(0,0,50,50);
+
+    // Hashed on the thread pool, then known for the next call
+    canvas.toBuffer(function(err, a){
+      assert.ok(!err);
+      canvas.toBuffer(function(err, b){
+        assert.ok(!err);
+        assert.equal(a.toString('base64'), b.toString('base64'));
+        assert.equal(canvas.toBuffer().toString('base64'), b.toString('base64'));
+      });
+    });
+  },
+  
+  'test Canvas#toBuffer({ strips: n })': function(assert){
+    var canvas = new Canvas(300, 300)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'rgba(0,128,255,0.75)';
+    ctx.fillRect(10,10,250,200);
+
+    var serial = canvas.toBuffer({ backend: 'zlib' });
+    [2, 3, 8, 1000].forEach(function(n){
+      var buf = canvas.toBuffer({ strips: n });
+      assert.equal('PNG', buf.slice(1,4).toString());
+      assert.equal('IEND', buf.slice(buf.length - 8, buf.length - 4).toString());
+      assert.ok(buf.length < serial.length * 2);
+    });
+  },
+  
+  'test Canvas#toBuffer({ palette: true })': function(assert){
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'red';
+    ctx.fillRect(0,0,100,100);
+    ctx.fillStyle = 'rgba(0,0,255,0.5)';
+    ctx.arc(100,100,50,0,Math.PI*2);
+    ctx.fill();
+
+    var buf = canvas.toBuffer({ palette: true });
+    assert.equal('PNG', buf.slice(1,4).toString());
+    assert.equal(3, buf[25], 'expected indexed color type');
+    assert.ok(buf.length < canvas.toBuffer({ backend: 'zlib' }).length);
+
+    buf = canvas.toBuffer({ palette: true, dither: true });
+    assert.equal(3, buf[25]);
+
+    var err;
+    try {
+      canvas.toBuffer({ palette: true, backend: 'cairo' });
+    } catch (e) {
+      err = e;
+    }
+    assert.equal('palette requires the zlib or libdeflate backend', err.message);
+  },
+  
+  'test Canvas#toBuffer("image/jpeg")': function(assert){
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'red';
+    ctx.fillRect(0,0,100,100);
+
+    var buf = canvas.toBuffer('image/jpeg');
+    assert.equal(0xff, buf[0]);
+    assert.equal(0xd8, buf[1]);
+
+    buf = canvas.toBuffer('image/jpeg', { progressive: true });
+    assert.equal(0xff, buf[0]);
+    assert.equal(0xd8, buf[1]);
+
+    assert.ok(canvas.toBuffer('image/jpeg', { quality: 100 }).length
+      > canvas.toBuffer('image/jpeg', { quality: 10 }).length);
+  },
+  
+  'test Canvas#toBuffer("raw")': function(assert){
+    var canvas = new Canvas(2, 1)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = 'rgba(255,0,0,0.5)';
+    ctx.fillRect(0,0,1,1);
+
+    var buf = canvas.toBuffer('raw');
+    assert.equal(8, buf.length);
+    assert.equal(255, buf[0]);
+    assert.equal(0, buf[1]);
+    assert.equal(0, buf[2]);
+    assert.ok(Math.abs(128 - buf[3]) <= 1);
+    assert.equal(0, buf[7]);
+
+    buf = canvas.toBuffer('raw', { format: 'argb' });
+    assert.equal(buf[0], buf[1]);
+    assert.equal(0, buf[3]);
+
+    buf = canvas.toBuffer('raw', { format: 'bgra' });
+    assert.equal(0, buf[0]);
+    assert.equal(buf[3], buf[2]);
+
+    var err;
+    try {
+      canvas.toBuffer('raw', { format: 'cmyk' });
+    } catch (e) {
+      err = e;
+    }
+    assert.equal('invalid raw format', err.message);
+  },
+
+  'test Canvas#getRawBuffer()': function(assert){
+    var canvas = new Canvas(10, 2)
+      , ctx = canvas.getContext('2d');
+
+    var raw = canvas.getRawBuffer();
+    assert.equal(canvas.stride * 2, raw.length);
+    assert.equal(0, raw[3]);
+
+    // Live view of the surface
+    ctx.fillStyle = '#fff';
+    ctx.fillRect(0,0,1,1);
+    assert.equal(255, raw[3]);
+
+    // Matches the bgra export
+    var bgra = canvas.toBuffer('raw', { format: 'bgra' });
+    for (var i = 0; i < 40; ++i) assert.equal(bgra[i], raw[i]);
+
+    // Untracked writes are not served stale from the cache
+    var hash = canvas.contentHash();
+    raw[7] = 255;
+    assert.ok(hash != canvas.contentHash());
+    assert.equal(255, canvas.toBuffer('raw', { format: 'bgra' })[7]);
+
+    // Outlives a resize
+    canvas.width = 20;
+    assert.equal(255, raw[3]);
+    assert.equal(0, canvas.getRawBuffer()[3]);
+  },
+
+  'test Canvas over external memory': function(assert){
+    var pixels = new Buffer(64 * 64 * 4);
+    for (var i = 0; i < pixels.length; ++i) pixels[i] = 0;
+    pixels[3] = 255;
+
+    var canvas = new Canvas(pixels, 64, 64)
+      , ctx = canvas.getContext('2d');
+    assert.equal(64 * 4, canvas.stride);
+    assert.eql({ x: 0, y: 0, width: 64, height: 64 }, canvas.getDirtyRect());
+    assert.equal(255, ctx.getImageData(0,0,1,1).data[3]);
+
+    // Drawing writes through
+    ctx.fillStyle = '#fff';
+    ctx.fillRect(1,0,1,1);
+    assert.equal(255, pixels[7]);
+
+    // External writes
+    var hash = canvas.contentHash()
+      , generation = canvas.generation;
+    pixels[11] = 255;
+    canvas.resetDirty();
+    canvas.markDirty(2, 0, 1, 1);
+    assert.ok(canvas.generation > generation);
+    assert.ok(hash != canvas.contentHash());
+    assert.eql({ x: 2, y: 0, width: 1, height: 1 }, canvas.getDirtyRect());
+
+    var err;
+    try {
+      new Canvas(pixels, 64, 64, { stride: 255 });
+    } catch (e) {
+      err = e;
+    }
+    assert.equal('invalid stride', err.message);
+
+    try {
+      new Canvas(pixels, 64, 65);
+    } catch (e) {
+      err = e;
+    }
+    assert.equal('buffer too small', err.message);
+  },
+
+  'test Canvas#toBuffer("image/jpeg") async': function(assert, beforeExit){
+    var buf;
+    new Canvas(200, 200).toBuffer('image/jpeg', { quality: 50 }, function(err, res){
+      assert.ok(!err);
+      buf = res;
+    });
+    beforeExit(function(){
+      assert.equal(0xff, buf[0]);
+      assert.equal(0xd8, buf[1]);
+    });
+  },
+  
+  'test Canvas#createJPEGStream()': function(assert, beforeExit){
+    var canvas = new Canvas(200, 200)
+      , stream = canvas.createJPEGStream({ quality: 80 })
+      , chunks = []
+      , ended = false;
+
+    stream.on('data', function(chunk, len){
+      assert.equal(len, chunk.length);
+      chunks.push(chunk);
+    });
+
+    stream.on('end', function(){
+      ended = true;
+    });
+
+    beforeExit(function(){
+      assert.ok(ended, 'did not emit end');
+      assert.ok(chunks.length);
+      assert.equal(0xff, chunks[0][0]);
+      assert.equal(0xd8, chunks[0][1]);
+    });
+  },
+  
+  'test Canvas#createPNGStream()': function(assert, beforeExit){
+    var canvas = new Canvas(200, 200)
+      , stream = canvas.createPNGStream()
+      , chunks = []
+      , ended = false;
+
+    stream.on('data', function(chunk, len){
+      assert.equal(len, chunk.length);
+      chunks.push(chunk);
+    });
+
+    stream.on('end', function(){
+      ended = true;
+    });
+
+    stream.on('error', function(err){
+      assert.fail(err.message);
+    });
+
+    beforeExit(function(){
+      assert.ok(ended, 'did not emit end');
+      assert.ok(chunks.length);
+      assert.equal('PNG', chunks[0].slice(1,4).toString());
+    });
+  },
+  
   'test Canvas#toDataURL()': function(assert){
     var canvas = new Canvas(200, 200)
       , ctx = canvas.getContext('2d');
@@ -316,11 +952,17 @@ module.exports = {
 
     var err;
     try {
-      canvas.toDataURL('image/jpeg');
+      canvas.toDataURL('image/gif');
     } catch (e) {
       err = e;
     }
-    assert.equal('currently only image/png is supported', err.message);
+    assert.equal('currently only image/png and image/jpeg are supported', err.message);
+  },
+  
+  'test Canvas#toDataURL("image/jpeg")': function(assert){
+    var canvas = new Canvas(200, 200);
+    assert.ok(0 == canvas.toDataURL('image/jpeg').indexOf('data:image/jpeg;base64,'));
+    assert.ok(0 == canvas.toDataURL('image/jpeg', { quality: 20 }).indexOf('data:image/jpeg;base64,'));
   },
   
   'test Canvas#toDataURL() async': function(assert){
@@ -337,6 +979,206 @@ module.exports = {
     });
   },
   
+  'test Context2d#shadowBlur': function(assert){
+    var canvas = new Canvas(40, 40)
+      , ctx = canvas.getContext('2d');
+
+    // Shadow only
+    ctx.fillStyle = 'rgba(0,0,0,0)';
+    ctx.shadowColor = '#000';
+    ctx.shadowBlur = 4;
+    ctx.fillRect(0,0,10,10);
+
+    function alpha(x, y) {
+      return ctx.getImageData(x, y, 1, 1).data[3];
+    }
+
+    // Blurred right up to the canvas edge
+    assert.ok(alpha(0,0) > 0);
+    assert.ok(alpha(0,0) < 255);
+    assert.ok(alpha(5,5) > alpha(0,0));
+
+    // Spread evenly beyond the shape
+    assert.ok(alpha(12,5) > 0);
+    assert.equal(alpha(12,5), alpha(5,12));
+    assert.equal(0, alpha(30,30));
+  },
+
+  'test Context2d#shadowBlur small shape on a large canvas': function(assert){
+    var canvas = new Canvas(750, 750)
+      , ctx = canvas.getContext('2d');
+
+    ctx.shadowColor = '#000';
+    ctx.shadowBlur = 5;
+    ctx.shadowOffsetX = 20;
+    ctx.beginPath();
+    ctx.arc(100,100,10,0,Math.PI*2,true);
+    ctx.fill();
+
+    function alpha(x, y) {
+      return ctx.getImageData(x, y, 1, 1).data[3];
+    }
+
+    // Shadow under the offset shape, fading out within its spread
+    assert.ok(alpha(120,100) > 128);
+    assert.ok(alpha(134,100) > 0);
+    assert.ok(alpha(134,100) < 255);
+    assert.equal(0, alpha(150,100));
+    assert.equal(0, alpha(700,700));
+  },
+
+  'test Context2d#shadowColor': function(assert){
+    var canvas = new Canvas(40, 40)
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = '#00f';
+    ctx.shadowColor = 'rgba(255,0,0,0.5)';
+    ctx.shadowBlur = 2;
+    ctx.shadowOffsetX = 20;
+    ctx.fillRect(0,0,10,20);
+
+    // Shape keeps its fill, the shadow takes the shadow colour
+    var shape = ctx.getImageData(5,10,1,1).data
+      , shadow = ctx.getImageData(25,10,1,1).data;
+    assert.eql([0, 0, 255, 255], [shape[0], shape[1], shape[2], shape[3]]);
+    assert.eql([255, 0, 0], [shadow[0], shadow[1], shadow[2]]);
+    assert.ok(Math.abs(128 - shadow[3]) <= 2);
+  },
+
+  'test Context2d#shadowBlur repeated shapes': function(assert){
+    var canvas = new Canvas(160, 40)
+      , ctx = canvas.getContext('2d');
+
+    function marker(x, color, blur) {
+      ctx.shadowColor = color;
+      ctx.shadowBlur = blur;
+      ctx.beginPath();
+      ctx.arc(x, 20, 5, 0, Math.PI * 2, true);
+      ctx.fill();
+    }
+
+    function row(x) {
+      return Array.prototype.slice.call(ctx.getImageData(x - 15, 20, 30, 1).data);
+    }
+
+    marker(20, '#000', 3);
+    marker(60, '#000', 3);
+    marker(120, '#000', 6);
+
+    // Same shape, same shadow wherever it is drawn
+    assert.eql(row(20), row(60));
+
+    // A different blur is not served the same mask
+    assert.ok(row(120)[3] > row(60)[3]);
+
+    // Cached masks take the current shadow colour
+    ctx.fillStyle = 'rgba(0,0,0,0)';
+    ctx.clearRect(0, 0, 160, 40);
+    marker(20, '#f00', 3);
+    var px = ctx.getImageData(20 - 8, 20, 1, 1).data;
+    assert.equal(255, px[0]);
+    assert.ok(px[3] > 0);
+  },
+
+  'test Context2d#save() / restore() nesting': function(assert){
+    var canvas = new Canvas(10, 10)
+      , ctx = canvas.getContext('2d')
+      , before = Canvas.memoryStats().context2d.bytes;
+
+    for (var i = 0; i < 200; ++i) {
+      ctx.save();
+      ctx.globalAlpha = 1 / (i + 2);
+    }
+    var grown = Canvas.memoryStats().context2d.bytes;
+    assert.ok(grown > before);
+    for (var i = 0; i < 200; ++i) ctx.restore();
+    assert.equal(1, ctx.globalAlpha);
+
+    // Slots are reused once grown
+    for (var i = 0; i < 200; ++i) ctx.save();
+    for (var i = 0; i < 200; ++i) ctx.restore();
+    assert.equal(grown, Canvas.memoryStats().context2d.bytes);
+
+    // Unbalanced restores leave the context usable
+    ctx.restore();
+    ctx.fillRect(0,0,1,1);
+    assert.equal(255, ctx.getImageData(0,0,1,1).data[3]);
+
+    // Saved gradients outlive their setters
+    var grad = ctx.createLinearGradient(0,0,10,0);
+    grad.addColorStop(0, '#f00');
+    grad.addColorStop(1, '#f00');
+    ctx.fillStyle = grad;
+    ctx.save();
+    ctx.fillStyle = '#00f';
+    ctx.restore();
+    ctx.save();
+    ctx.restore();
+    ctx.fillRect(0,0,10,10);
+    var px = ctx.getImageData(5,5,1,1).data;
+    assert.equal(255, px[0]);
+    assert.equal(0, px[2]);
+  },
+
+  'test Context2d#resetScratch()': function(assert){
+    var canvas = new Canvas(40, 40, { format: 'rgb16_565' })
+      , ctx = canvas.getContext('2d');
+
+    function render() {
+      ctx.fillStyle = '#f00';
+      ctx.shadowColor = '#000';
+      ctx.shadowBlur = 2;
+      ctx.fillRect(5, 5, 20, 20);
+      ctx.putImageData(ctx.getImageData(0, 0, 20, 20), 20, 20);
+      canvas.toBuffer();
+      ctx.resetScratch();
+    }
+
+    // Transient buffers come from the canvas arena,
+    // which stops allocating once warm
+    render();
+    var mallocs = Canvas.memoryStats().scratch.mallocs;
+    for (var i = 0; i < 10; ++i) render();
+    assert.equal(mallocs, Canvas.memoryStats().scratch.mallocs);
+    assert.ok(Canvas.memoryStats().scratch.bytes > 0);
+  },
+
+  'test Context2d#setFillRGBA()': function(assert){
+    var canvas = new Canvas(10, 10)
+      , ctx = canvas.getContext('2d');
+
+    ctx.setFillRGBA(255, 200, 90, 0.5);
+    assert.equal('rgba(255, 200, 90, 0.50)', ctx.fillStyle);
+
+    ctx.setFillRGBA(0xffc85aff);
+    assert.equal('#ffc85a', ctx.fillStyle);
+
+    ctx.setFillRGBA('red');
+    ctx.setFillRGBA(1, 2);
+    assert.equal('#ffc85a', ctx.fillStyle);
+
+    ctx.setStrokeRGBA(0, 0, 255);
+    assert.equal('#0000ff', ctx.strokeStyle);
+
+    ctx.setShadowRGBA(0xff000080);
+    assert.equal('rgba(255, 0, 0, 0.50)', ctx.shadowColor);
+
+    // Replaces a gradient
+    var grad = ctx.createLinearGradient(0,0,10,0);
+    grad.addColorStop(0, '#00f');
+    grad.addColorStop(1, '#00f');
+    ctx.fillStyle = grad;
+    assert.equal(grad, ctx.fillStyle);
+    ctx.setFillRGBA(0, 255, 0, 1);
+    assert.equal('#00ff00', ctx.fillStyle);
+    ctx.setShadowRGBA(0, 0, 0, 0);
+    ctx.fillRect(0,0,10,10);
+    var px = ctx.getImageData(5,5,1,1).data;
+    assert.equal(0, px[0]);
+    assert.equal(255, px[1]);
+    assert.equal(0, px[2]);
+  },
+
   'test Context2d#createImageData(width, height)': function(assert){
     var canvas = new Canvas(20, 20)
       , ctx = canvas.getContext('2d');
@@ -362,6 +1204,29 @@ module.exports = {
     assert.equal(2 * 6 * 4, imageData.data.length);
   },
   
+  'test Context2d#putImageData() premultiplied round trip': function(assert){
+    var ctx = new Canvas(20, 1).getContext('2d')
+      , data = ctx.createImageData(20, 1)
+      , i;
+
+    for (i = 0; i < 20; ++i) {
+      data.data[i * 4] = 255;
+      data.data[i * 4 + 1] = 100;
+      data.data[i * 4 + 2] = 7;
+      data.data[i * 4 + 3] = i ? 128 : 0;
+    }
+    ctx.putImageData(data, 0, 0);
+
+    var out = ctx.getImageData(0,0,20,1).data;
+    assert.eql([0,0,0,0], [].slice.call(out, 0, 4));
+    for (i = 1; i < 20; ++i) {
+      assert.equal(255, out[i * 4]);
+      assert.ok(Math.abs(100 - out[i * 4 + 1]) <= 1);
+      assert.ok(Math.abs(7 - out[i * 4 + 2]) <= 1);
+      assert.equal(128, out[i * 4 + 3]);
+    }
+  },
+  
   'test Context2d#getImageData()': function(assert){
     var canvas = new Canvas(3, 6)
       , ctx = canvas.getContext('2d');
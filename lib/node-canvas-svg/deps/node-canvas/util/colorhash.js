@@ -0,0 +1,102 @@
+/*!
+ * Canvas - colorhash
+ * Copyright (c) 2010 LearnBoost <tj@learnboost.com>
+ * MIT Licensed
+ */
+
+/**
+ * Generate the perfect hash tables for the named colors
+ * of src/color.cc, paste the output over the tables there
+ * after changing the names:
+ *
+ *   $ node util/colorhash.js
+ *
+ * Names hash to one of BUCKETS buckets, each bucket picks
+ * the smallest displacement placing all its names in free
+ * slots, see COLOR_SLOT() in src/color.cc.
+ */
+
+var fs = require('fs')
+  , path = require('path');
+
+var BUCKETS = 64
+  , SLOTS = 256;
+
+/**
+ * Unsigned 32 bit multiplication.
+ */
+
+function mul(a, b) {
+  return ((((a >>> 16) * b & 0xffff) << 16) + (a & 0xffff) * b) >>> 0;
+}
+
+/**
+ * Return [h1, h2] for `name`, see rgba_from_string().
+ */
+
+function hash(name) {
+  var h1 = 2166136261, h2 = 0;
+  for (var i = 0; i < name.length; ++i) {
+    var c = name.charCodeAt(i);
+    h1 = mul((h1 ^ c) >>> 0, 16777619);
+    h2 = (mul(h2, 31) + c) >>> 0;
+  }
+  return [h1, h2];
+}
+
+/**
+ * Slot for `h2` displaced by `d`.
+ */
+
+function slot(h2, d) {
+  return mul((h2 + mul(d, 0x9e3779b9)) >>> 0, 0x85ebca6b) >>> 24;
+}
+
+var src = fs.readFileSync(path.join(__dirname, '..', 'src', 'color.cc'), 'utf8')
+  , re = /\{ "([a-z]+)", 0x[0-9a-f]{8} ?\}/g
+  , names = []
+  , m;
+
+while (m = re.exec(src)) names.push(m[1]);
+
+var buckets = []
+  , disp = []
+  , slots = [];
+
+for (var i = 0; i < BUCKETS; ++i) buckets[i] = [], disp[i] = 0;
+for (var i = 0; i < SLOTS; ++i) slots[i] = 255;
+names.forEach(function(name, i){
+  var h = hash(name);
+  buckets[h[0] % BUCKETS].push({ index: i, h2: h[1] });
+});
+
+buckets
+  .map(function(keys, i){ return { index: i, keys: keys }; })
+  .sort(function(a, b){ return b.keys.length - a.keys.length; })
+  .forEach(function(bucket){
+    if (!bucket.keys.length) return;
+    for (var d = 0; d < 256; ++d) {
+      var taken = {}, ok = bucket.keys.every(function(key){
+        var s = slot(key.h2, d);
+        if (255 != slots[s] || taken[s]) return false;
+        return taken[s] = true;
+      });
+      if (!ok) continue;
+      bucket.keys.forEach(function(key){ slots[slot(key.h2, d)] = key.index; });
+      disp[bucket.index] = d;
+      return;
+    }
+    throw new Error('no displacement for bucket ' + bucket.index + ', grow SLOTS');
+  });
+
+function table(type, name, vals) {
+  var out = 'static const ' + type + ' ' + name + '[' + vals.length + '] = {\n';
+  for (var i = 0; i < vals.length; i += 16) {
+    out += (i ? '  , ' : '    ') + vals.slice(i, i + 16).join(', ') + '\n';
+  }
+  return out + '};\n';
+}
+
+console.log('/*\n * Generated by util/colorhash.js for %d names.\n */\n', names.length);
+console.log(table('uint8_t', 'color_disp', disp));
+console.log(table('uint8_t', 'color_slots', slots));